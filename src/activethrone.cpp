@@ -31,7 +31,7 @@ void CActiveThrone::ManageStatus()
         pmn = mnodeman.Find(pubKeyThrone);
         if(pmn != NULL) {
             pmn->Check();
-            if(pmn->IsEnabled() && pmn->protocolVersion == PROTOCOL_VERSION) EnableHotColdThroNe(pmn->vin, pmn->addr);
+            if(pmn->IsEnabled() && pmn->protocolVersion >= MIN_THRONE_PAYMENT_PROTO_VERSION_2) EnableHotColdThroNe(pmn->vin, pmn->addr);
         }
     }
 
@@ -69,13 +69,25 @@ base_uint<BITS>& base_uint<BITS>::operator*=(const base_uint& b)
 {
     base_uint<BITS> a = *this;
     *this = 0;
+    // Skip the zero limbs on either side: retarget factors such as block
+    // counts and timespans fill only one or two limbs.
+    int nb = WIDTH;
+    while (nb > 0 && b.pn[nb - 1] == 0)
+        nb--;
     for (int j = 0; j < WIDTH; j++) {
+        if (a.pn[j] == 0)
+            continue;
         uint64_t carry = 0;
-        for (int i = 0; i + j < WIDTH; i++) {
+        for (int i = 0; i < nb && i + j < WIDTH; i++) {
             uint64_t n = carry + pn[i + j] + (uint64_t)a.pn[j] * b.pn[i];
             pn[i + j] = n & 0xffffffff;
             carry = n >> 32;
         }
+        for (int i = nb; carry != 0 && i + j < WIDTH; i++) {
+            uint64_t n = carry + pn[i + j];
+            pn[i + j] = n & 0xffffffff;
+            carry = n >> 32;
+        }
     }
     return *this;
 }
@@ -83,26 +95,87 @@ base_uint<BITS>& base_uint<BITS>::operator*=(const base_uint& b)
 template <unsigned int BITS>
 base_uint<BITS>& base_uint<BITS>::operator/=(const base_uint& b)
 {
-    base_uint<BITS> div = b;     // make a copy, so we can shift.
-    base_uint<BITS> num = *this; // make a copy, so we can subtract.
-    *this = 0;                   // the quotient.
-    int num_bits = num.bits();
-    int div_bits = div.bits();
-    if (div_bits == 0)
+    // Schoolbook long division on whole 32-bit limbs with 64-bit
+    // intermediates (Knuth, TAOCP vol. 2, 4.3.1, algorithm D).
+    int n = WIDTH;
+    while (n > 0 && b.pn[n - 1] == 0)
+        n--;
+    if (n == 0)
         throw uint_error("Division by zero");
-    if (div_bits > num_bits) // the result is certainly 0.
+    int m = WIDTH;
+    while (m > 0 && pn[m - 1] == 0)
+        m--;
+    if (m < n) { // the result is certainly 0.
+        *this = 0;
         return *this;
-    int shift = num_bits - div_bits;
-    div <<= shift; // shift so that div and num align.
-    while (shift >= 0) {
-        if (num >= div) {
-            num -= div;
-            pn[shift / 32] |= (1 << (shift & 31)); // set a bit of the result.
+    }
+
+    if (n == 1) {
+        // Single-limb divisor: one hardware division per limb.
+        uint64_t rem = 0;
+        for (int i = m - 1; i >= 0; i--) {
+            uint64_t cur = (rem << 32) | pn[i];
+            pn[i] = (uint32_t)(cur / b.pn[0]);
+            rem = cur % b.pn[0];
+        }
+        return *this;
+    }
+
+    // Normalize so the top limb of the divisor has its high bit set; this
+    // keeps each estimated quotient limb at most two too large.
+    int s = 0;
+    while (((b.pn[n - 1] << s) & 0x80000000) == 0)
+        s++;
+    uint32_t vn[WIDTH];
+    uint32_t un[WIDTH + 1];
+    for (int i = n - 1; i > 0; i--)
+        vn[i] = (uint32_t)((((uint64_t)b.pn[i] << 32) | b.pn[i - 1]) >> (32 - s));
+    vn[0] = b.pn[0] << s;
+    un[m] = (uint32_t)((uint64_t)pn[m - 1] >> (32 - s));
+    for (int i = m - 1; i > 0; i--)
+        un[i] = (uint32_t)((((uint64_t)pn[i] << 32) | pn[i - 1]) >> (32 - s));
+    un[0] = pn[0] << s;
+
+    *this = 0; // the quotient.
+    for (int j = m - n; j >= 0; j--) {
+        // Estimate the quotient limb from the top two limbs of the remainder.
+        uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+        uint64_t qhat = num / vn[n - 1];
+        uint64_t rhat = num % vn[n - 1];
+        while (qhat > 0xffffffff || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat > 0xffffffff)
+                break;
         }
-        div >>= 1; // shift back.
-        shift--;
+
+        // Subtract qhat times the divisor from the running remainder.
+        uint64_t carry = 0;
+        uint64_t borrow = 0;
+        for (int i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i] + carry;
+            carry = p >> 32;
+            uint64_t t = (uint64_t)un[i + j] - (p & 0xffffffff) - borrow;
+            un[i + j] = (uint32_t)t;
+            borrow = t >> 63;
+        }
+        bool fNegative = un[j + n] < carry + borrow;
+        un[j + n] -= carry + borrow;
+
+        if (fNegative) {
+            // The estimate was one too large: add the divisor back.
+            qhat--;
+            carry = 0;
+            for (int i = 0; i < n; i++) {
+                uint64_t t = (uint64_t)un[i + j] + vn[i] + carry;
+                un[i + j] = (uint32_t)t;
+                carry = t >> 32;
+            }
+            un[j + n] += carry;
+        }
+        pn[j] = (uint32_t)qhat;
     }
-    // num now contains the remainder of the division.
+    // un[0..n) >> s now contains the remainder of the division.
     return *this;
 }
 
@@ -173,11 +246,15 @@ unsigned int base_uint<BITS>::bits() const
 {
     for (int pos = WIDTH - 1; pos >= 0; pos--) {
         if (pn[pos]) {
-            for (int bits = 31; bits > 0; bits--) {
-                if (pn[pos] & 1 << bits)
-                    return 32 * pos + bits + 1;
-            }
-            return 32 * pos + 1;
+            // Binary search for the top set bit of the limb.
+            uint32_t x = pn[pos];
+            unsigned int nBits = 32 * pos + 1;
+            if (x >> 16) { x >>= 16; nBits += 16; }
+            if (x >> 8) { x >>= 8; nBits += 8; }
+            if (x >> 4) { x >>= 4; nBits += 4; }
+            if (x >> 2) { x >>= 2; nBits += 2; }
+            if (x >> 1) { nBits += 1; }
+            return nBits;
         }
     }
     return 0;
@@ -209,8 +286,14 @@ arith_uint256& arith_uint256::SetCompact(uint32_t nCompact, bool* pfNegative, bo
         nWord >>= 8 * (3 - nSize);
         *this = nWord;
     } else {
-        *this = nWord;
-        *this <<= 8 * (nSize - 3);
+        // Place the mantissa directly instead of shifting a whole number.
+        *this = 0;
+        unsigned int shift = 8 * (nSize - 3);
+        unsigned int k = shift / 32, r = shift % 32;
+        if (k < WIDTH)
+            pn[k] = nWord << r;
+        if (k + 1 < WIDTH && r != 0)
+            pn[k + 1] = nWord >> (32 - r);
     }
     if (pfNegative)
         *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
@@ -228,8 +311,13 @@ uint32_t arith_uint256::GetCompact(bool fNegative) const
     if (nSize <= 3) {
         nCompact = GetLow64() << 8 * (3 - nSize);
     } else {
-        arith_uint256 bn = *this >> 8 * (nSize - 3);
-        nCompact = bn.GetLow64();
+        // Read the top three bytes straight out of the limbs they span.
+        unsigned int shift = 8 * (nSize - 3);
+        unsigned int k = shift / 32, r = shift % 32;
+        nCompact = pn[k] >> r;
+        if (k + 1 < WIDTH && r != 0)
+            nCompact |= pn[k + 1] << (32 - r);
+        nCompact &= 0x00ffffff;
     }
     // The 0x00800000 bit denotes the sign.
     // Thus, if it is already set, divide the mantissa by 256 and increase the exponent.
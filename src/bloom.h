@@ -53,6 +53,10 @@ private:
 
     unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
 
+    // Private constructor for CRollingBloomFilter, no restrictions on size
+    CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
+    friend class CRollingBloomFilter;
+
 public:
     /**
      * Creates a new bloom filter which will provide the given fp rate when filled with the given number of elements
@@ -97,4 +101,46 @@ public:
     void UpdateEmptyFull();
 };
 
+/**
+ * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
+ * Construct it with the number of items to keep track of, a false-positive rate
+ * and a random tweak, which salts the hashes so that peers can't predict each
+ * other's false positives.
+ *
+ * contains(item) will always return true if item was one of the last N things
+ * insert()'ed ... but may also return true for items that were not inserted.
+ *
+ * Unlike an mruset it uses a fixed amount of memory and no per-item allocations,
+ * which makes it suitable for the per-peer "already known" relay bookkeeping.
+ *
+ * Every bit of the filter is a 2-bit generation number, 0 meaning unset. Items
+ * are inserted in generations of nElements / 2, and starting a new generation
+ * wipes the bits of the one three generations back, so between nElements and
+ * 1.5 * nElements of the most recent items are remembered.
+ */
+class CRollingBloomFilter
+{
+public:
+    CRollingBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
+
+    void insert(const unsigned char* pKey, size_t nKeyLen);
+    void insert(const std::vector<unsigned char>& vKey);
+    void insert(const uint256& hash);
+    bool contains(const unsigned char* pKey, size_t nKeyLen) const;
+    bool contains(const std::vector<unsigned char>& vKey) const;
+    bool contains(const uint256& hash) const;
+
+    void clear();
+
+private:
+    int nEntriesPerGeneration;
+    int nEntriesThisGeneration;
+    int nGeneration;
+    //! Bit P of the filter is bit (P & 63) of both data[(P >> 6) * 2] (low
+    //! bit of the generation) and data[(P >> 6) * 2 + 1] (high bit)
+    std::vector<uint64_t> data;
+    unsigned int nTweak;
+    int nHashFuncs;
+};
+
 #endif // BITCOIN_BLOOM_H
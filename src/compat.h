@@ -91,8 +91,14 @@ typedef u_int SOCKET;
 
 size_t strnlen_int( const char *start, size_t max_len);
 
+#ifdef HAVE_SYS_EPOLL_H
+// Peer sockets are polled with epoll and single sockets with poll(), neither
+// of which is limited to FD_SETSIZE descriptors
+#define USE_EPOLL 1
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
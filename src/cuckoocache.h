@@ -0,0 +1,158 @@
+// Copyright (c) 2015 The Terracoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include "uint256.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+#include <string.h>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+
+struct CCuckooCacheStats
+{
+    uint32_t nSlots;
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+};
+
+/**
+ * Fixed-size set of 256-bit entries, for remembering what has already been
+ * found valid. Entries must be uniformly random (salted hashes), as each of
+ * their first WAYS words picks a candidate slot, cuckoo style. Inserts take
+ * a free candidate or evict the one written in the oldest epoch; a new epoch
+ * starts every time a quarter of the slots has been written.
+ *
+ * Each slot is guarded by a version that is odd while a writer owns it.
+ * Readers copy the entry and check the version did not change meanwhile (a
+ * seqlock), so neither lookups nor inserts take a lock. An insert that finds
+ * its slot busy is dropped, which is fine for a cache.
+ */
+class CCuckooCache
+{
+private:
+    /** Number of slots an entry may live in */
+    static const int WAYS = 4;
+
+    struct CSlot
+    {
+        boost::atomic<uint32_t> nVersion;
+        //! epoch the entry was inserted in, 0 if the slot is free
+        boost::atomic<uint32_t> nEpoch;
+        boost::atomic<uint32_t> vWords[8];
+    };
+
+    boost::scoped_array<CSlot> slots;
+    uint32_t nSlots;
+    boost::atomic<uint32_t> nEpoch;
+    boost::atomic<uint32_t> nEpochInserts;
+    boost::atomic<uint64_t> nHits;
+    boost::atomic<uint64_t> nMisses;
+    boost::atomic<uint64_t> nInserts;
+
+    CSlot& Slot(uint32_t nWord)
+    {
+        return slots[((uint64_t)nWord * nSlots) >> 32];
+    }
+
+public:
+    CCuckooCache() : nSlots(0), nEpoch(1), nEpochInserts(0), nHits(0), nMisses(0), nInserts(0) {}
+
+    //! Allocate nBytes worth of slots. Not thread safe: call before the cache is shared
+    void Setup(size_t nBytes)
+    {
+        nSlots = std::min(nBytes / sizeof(CSlot), (size_t)std::numeric_limits<uint32_t>::max());
+        slots.reset(nSlots ? new CSlot[nSlots] : NULL);
+        for (uint32_t i = 0; i < nSlots; i++) {
+            slots[i].nVersion.store(0, boost::memory_order_relaxed);
+            slots[i].nEpoch.store(0, boost::memory_order_relaxed);
+        }
+    }
+
+    //! Look entry up, freeing its slot if fErase
+    bool Get(const uint256& entry, bool fErase)
+    {
+        uint32_t vEntry[8];
+        memcpy(vEntry, entry.begin(), sizeof(vEntry));
+        for (int i = 0; i < WAYS && nSlots; i++) {
+            CSlot& slot = Slot(vEntry[i]);
+            uint32_t nVersion = slot.nVersion.load(boost::memory_order_acquire);
+            if (nVersion & 1)
+                continue;
+            uint32_t nSlotEpoch = slot.nEpoch.load(boost::memory_order_relaxed);
+            bool fMatch = nSlotEpoch != 0;
+            for (int j = 0; j < 8 && fMatch; j++)
+                fMatch = slot.vWords[j].load(boost::memory_order_relaxed) == vEntry[j];
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            if (!fMatch || slot.nVersion.load(boost::memory_order_relaxed) != nVersion)
+                continue;
+            // A writer may have reused the slot since; losing that entry is harmless
+            if (fErase)
+                slot.nEpoch.compare_exchange_strong(nSlotEpoch, 0, boost::memory_order_relaxed);
+            nHits.fetch_add(1, boost::memory_order_relaxed);
+            return true;
+        }
+        nMisses.fetch_add(1, boost::memory_order_relaxed);
+        return false;
+    }
+
+    void Set(const uint256& entry)
+    {
+        if (nSlots == 0) return;
+
+        uint32_t vEntry[8];
+        memcpy(vEntry, entry.begin(), sizeof(vEntry));
+        uint32_t nCurrent = nEpoch.load(boost::memory_order_relaxed);
+
+        // Prefer a free candidate, then the one written longest ago
+        CSlot* pslot = NULL;
+        uint32_t nOldest = 0;
+        for (int i = 0; i < WAYS; i++) {
+            CSlot& slot = Slot(vEntry[i]);
+            uint32_t nSlotEpoch = slot.nEpoch.load(boost::memory_order_relaxed);
+            uint32_t nAge = nSlotEpoch == 0 ? std::numeric_limits<uint32_t>::max() : nCurrent - nSlotEpoch;
+            if (pslot == NULL || nAge > nOldest) {
+                pslot = &slot;
+                nOldest = nAge;
+            }
+        }
+
+        // If another thread is writing the slot, just skip caching this entry
+        uint32_t nVersion = pslot->nVersion.load(boost::memory_order_relaxed);
+        if ((nVersion & 1) || !pslot->nVersion.compare_exchange_strong(nVersion, nVersion + 1, boost::memory_order_acquire))
+            return;
+        boost::atomic_thread_fence(boost::memory_order_release);
+        pslot->nEpoch.store(nCurrent, boost::memory_order_relaxed);
+        for (int j = 0; j < 8; j++)
+            pslot->vWords[j].store(vEntry[j], boost::memory_order_relaxed);
+        pslot->nVersion.store(nVersion + 2, boost::memory_order_release);
+        nInserts.fetch_add(1, boost::memory_order_relaxed);
+
+        uint32_t nPerEpoch = std::max(nSlots / 4, (uint32_t)1);
+        if (nEpochInserts.fetch_add(1, boost::memory_order_relaxed) + 1 == nPerEpoch) {
+            nEpochInserts.fetch_sub(nPerEpoch, boost::memory_order_relaxed);
+            // epoch 0 marks free slots
+            if (nEpoch.fetch_add(1, boost::memory_order_relaxed) + 1 == 0)
+                nEpoch.fetch_add(1, boost::memory_order_relaxed);
+        }
+    }
+
+    void GetStats(CCuckooCacheStats& stats) const
+    {
+        stats.nSlots = nSlots;
+        stats.nBytes = (size_t)nSlots * sizeof(CSlot);
+        stats.nHits = nHits.load(boost::memory_order_relaxed);
+        stats.nMisses = nMisses.load(boost::memory_order_relaxed);
+        stats.nInserts = nInserts.load(boost::memory_order_relaxed);
+    }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
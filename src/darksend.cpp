@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "darksend.h"
+#include "random.h"
 #include "main.h"
 #include "init.h"
 #include "util.h"
@@ -1579,26 +1580,44 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun)
 
         int i = 0;
 
-        // otherwise, try one randomly
+        // otherwise, race a few random ones and take whichever answers first
         while(i < 10)
         {
-            CThrone* pmn = mnodeman.FindRandomNotInVec(vecThronesUsed, MIN_POOL_PEER_PROTO_VERSION);
-            if(pmn == NULL)
+            std::vector<CTxIn> vecExclude = vecThronesUsed;
+            std::vector<CThrone*> vecCandidates;
+            std::vector<CAddress> vecAddr;
+            while(i < 10 && vecCandidates.size() < DARKSEND_CONNECT_CANDIDATES)
             {
+                CThrone* pmn = mnodeman.FindRandomNotInVec(vecExclude, MIN_POOL_PEER_PROTO_VERSION);
+                if(pmn == NULL) break;
+                vecExclude.push_back(pmn->vin);
+                i++;
+
+                if(pmn->nLastDsq != 0 &&
+                    pmn->nLastDsq + mnodeman.CountEnabled(MIN_POOL_PEER_PROTO_VERSION)/5 > mnodeman.nDsqCount){
+                    continue;
+                }
+
+                vecCandidates.push_back(pmn);
+                vecAddr.push_back((CAddress)pmn->addr);
+            }
+            if(vecCandidates.empty())
+            {
+                if(i >= 10) break;
                 LogPrintf("DoAutomaticDenominating --- Can't find random throne!\n");
                 strAutoDenomResult = _("Can't find random Throne.");
                 return false;
             }
 
-            if(pmn->nLastDsq != 0 &&
-                pmn->nLastDsq + mnodeman.CountEnabled(MIN_POOL_PEER_PROTO_VERSION)/5 > mnodeman.nDsqCount){
-                i++;
-                continue;
-            }
-
             lastTimeChanged = GetTimeMillis();
-            LogPrintf("DoAutomaticDenominating --- attempt %d connection to Throne %s\n", i, pmn->addr.ToString());
-            CNode* pnode = ConnectNode((CAddress)pmn->addr, NULL, true);
+            LogPrintf("DoAutomaticDenominating --- attempt %d connection to %u Thrones\n", i, vecCandidates.size());
+            std::vector<CNode*> vecNodes = ConnectNodes(vecAddr, 1, true);
+            CNode* pnode = NULL;
+            CThrone* pmn = NULL;
+            for(unsigned int j = 0; j < vecNodes.size() && pnode == NULL; j++) {
+                pnode = vecNodes[j];
+                pmn = vecCandidates[j];
+            }
             if(pnode != NULL){
                 pSubmittedToThrone = pmn;
                 vecThronesUsed.push_back(pmn->vin);
@@ -1610,12 +1629,13 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun)
                     sessionDenom = GetDenominationsByAmounts(vecAmounts);
 
                 pnode->PushMessage("dsa", sessionDenom, txCollateral);
-                LogPrintf("DoAutomaticDenominating --- connected, sending dsa for %d\n", sessionDenom);
+                LogPrintf("DoAutomaticDenominating --- connected to %s, sending dsa for %d\n", pmn->addr.ToString(), sessionDenom);
                 strAutoDenomResult = _("Mixing in progress...");
                 return true;
             } else {
-                vecThronesUsed.push_back(pmn->vin); // postpone MN we wasn't able to connect to
-                i++;
+                // postpone MNs we weren't able to connect to
+                BOOST_FOREACH(CThrone* pmnFailed, vecCandidates)
+                    vecThronesUsed.push_back(pmnFailed->vin);
                 continue;
             }
         }
@@ -2104,14 +2124,33 @@ bool CDarkSendSigner::SignMessage(std::string strMessage, std::string& errorMess
     return true;
 }
 
+CDarkSendSigner::CDarkSendSigner()
+{
+    GetRandBytes(nonceCache.begin(), 32);
+}
+
+void CDarkSendSigner::InitCache(size_t nBytes)
+{
+    cacheVerified.Setup(nBytes);
+}
+
 bool CDarkSendSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    uint256 hash = ss.GetHash();
+
+    // The same ping, vote or winner arrives from many peers; only recover the key once.
+    // Key and signature are serialized with their lengths so no two inputs share an entry.
+    CHashWriter ssEntry(SER_GETHASH, 0);
+    ssEntry << nonceCache << hash << pubkey << vchSig;
+    uint256 entry = ssEntry.GetHash();
+    if (cacheVerified.Get(entry, false))
+        return true;
 
     CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    if (!pubkey2.RecoverCompact(hash, vchSig)) {
         errorMessage = _("Error recovering public key.");
         return false;
     }
@@ -2123,6 +2162,7 @@ bool CDarkSendSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSi
         return false;
     }
 
+    cacheVerified.Set(entry);
     return true;
 }
 
@@ -7,6 +7,7 @@
 
 #include "main.h"
 #include "sync.h"
+#include "cuckoocache.h"
 #include "activethrone.h"
 #include "throneman.h"
 #include "throne-payments.h"
@@ -48,6 +49,10 @@ class CActiveThrone;
 
 static const int64_t DARKSEND_COLLATERAL = (0.01*COIN);
 static const int64_t DARKSEND_POOL_MAX = (9999.99*COIN);
+// memory for remembering message signatures already verified (4MB, about a hundred thousand)
+static const size_t DARKSEND_SIG_CACHE_SIZE = 4 << 20;
+// number of random Thrones raced when looking for one to mix with
+static const unsigned int DARKSEND_CONNECT_CANDIDATES = 3;
 
 extern CDarksendPool darkSendPool;
 extern CDarkSendSigner darkSendSigner;
@@ -244,7 +249,16 @@ public:
  */
 class CDarkSendSigner
 {
+private:
+    //! Entries are SHA256(nonce || message hash || public key || signature) of verified messages
+    uint256 nonceCache;
+    CCuckooCache cacheVerified;
+
 public:
+    CDarkSendSigner();
+    /// Allocate the verified message cache; call once at startup, before messages arrive
+    void InitCache(size_t nBytes);
+    void GetCacheStats(CCuckooCacheStats& stats) const { cacheVerified.GetStats(stats); }
     /// Is the inputs associated with this public key? (and there is 10000 CRW - checking if valid throne)
     bool IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey);
     /// Set the private/public key values, returns true if successful
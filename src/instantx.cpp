@@ -100,27 +100,35 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
                 tx.GetHash().ToString().c_str()
             );
 
-            BOOST_FOREACH(const CTxIn& in, tx.vin){
-                if(!mapLockedInputs.count(in.prevout)){
-                    mapLockedInputs.insert(make_pair(in.prevout, tx.GetHash()));
+            bool fReprocess = false;
+            {
+                // Block validation reads the locks under cs_main
+                LOCK(cs_main);
+                BOOST_FOREACH(const CTxIn& in, tx.vin){
+                    if(!mapLockedInputs.count(in.prevout)){
+                        mapLockedInputs.insert(make_pair(in.prevout, tx.GetHash()));
+                    }
                 }
-            }
 
-            // resolve conflicts
-            std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(tx.GetHash());
-            if (i != mapTxLocks.end()){
-                //we only care if we have a complete tx lock
-                if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
-                    if(!CheckForConflictingLocks(tx)){
-                        LogPrintf("ProcessMessageInstantX::ix - Found Existing Complete IX Lock\n");
-
-                        //reprocess the last 15 blocks
-                        ReprocessBlocks(15);
-                        mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+                // resolve conflicts
+                std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(tx.GetHash());
+                if (i != mapTxLocks.end()){
+                    //we only care if we have a complete tx lock
+                    if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
+                        if(!CheckForConflictingLocks(tx)){
+                            LogPrintf("ProcessMessageInstantX::ix - Found Existing Complete IX Lock\n");
+                            fReprocess = true;
+                        }
                     }
                 }
             }
 
+            if(fReprocess){
+                //reprocess the last 15 blocks
+                ReprocessBlocks(15);
+                mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            }
+
             return;
         }
     }
@@ -216,6 +224,7 @@ bool IsIXTXValid(const CTransaction& txCollateral){
 
 int64_t CreateNewLock(CTransaction tx)
 {
+    LOCK(cs_main);
 
     int64_t nTxAge = 0;
     BOOST_REVERSE_FOREACH(CTxIn i, tx.vin){
@@ -326,69 +335,76 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         return false;
     }
 
-    if (!mapTxLocks.count(ctx.txHash)){
-        LogPrintf("InstantX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
-
-        CTransactionLock newLock;
-        newLock.nBlockHeight = 0;
-        newLock.nExpiration = GetTime()+(60*60);
-        newLock.nTimeout = GetTime()+(60*5);
-        newLock.txHash = ctx.txHash;
-        mapTxLocks.insert(make_pair(ctx.txHash, newLock));
-    } else
-        LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
-
-    //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
-    if (i != mapTxLocks.end()){
-        (*i).second.AddSignature(ctx);
+    bool fReprocess = false;
+    {
+        // Block validation reads the locks under cs_main
+        LOCK(cs_main);
+
+        if (!mapTxLocks.count(ctx.txHash)){
+            LogPrintf("InstantX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
+
+            CTransactionLock newLock;
+            newLock.nBlockHeight = 0;
+            newLock.nExpiration = GetTime()+(60*60);
+            newLock.nTimeout = GetTime()+(60*5);
+            newLock.txHash = ctx.txHash;
+            mapTxLocks.insert(make_pair(ctx.txHash, newLock));
+        } else
+            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
+
+        //compile consessus vote
+        std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
+        if (i != mapTxLocks.end()){
+            (*i).second.AddSignature(ctx);
 
 #ifdef ENABLE_WALLET
-        if(pwalletMain){
-            //when we get back signatures, we'll count them as requests. Otherwise the client will think it didn't propagate.
-            if(pwalletMain->mapRequestCount.count(ctx.txHash))
-                pwalletMain->mapRequestCount[ctx.txHash]++;
-        }
+            if(pwalletMain){
+                //when we get back signatures, we'll count them as requests. Otherwise the client will think it didn't propagate.
+                if(pwalletMain->mapRequestCount.count(ctx.txHash))
+                    pwalletMain->mapRequestCount[ctx.txHash]++;
+            }
 #endif
 
-        LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", (*i).second.CountSignatures(), ctx.GetHash().ToString().c_str());
+            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", (*i).second.CountSignatures(), ctx.GetHash().ToString().c_str());
 
-        if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
-            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
+            if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
+                LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
 
-            CTransaction& tx = mapTxLockReq[ctx.txHash];
-            if(!CheckForConflictingLocks(tx)){
+                CTransaction& tx = mapTxLockReq[ctx.txHash];
+                if(!CheckForConflictingLocks(tx)){
 
 #ifdef ENABLE_WALLET
-                if(pwalletMain){
-                    if(pwalletMain->UpdatedTransaction((*i).second.txHash)){
-                        nCompleteTXLocks++;
+                    if(pwalletMain){
+                        if(pwalletMain->UpdatedTransaction((*i).second.txHash)){
+                            nCompleteTXLocks++;
+                        }
                     }
-                }
 #endif
 
-                if(mapTxLockReq.count(ctx.txHash)){
-                    BOOST_FOREACH(const CTxIn& in, tx.vin){
-                        if(!mapLockedInputs.count(in.prevout)){
-                            mapLockedInputs.insert(make_pair(in.prevout, ctx.txHash));
+                    if(mapTxLockReq.count(ctx.txHash)){
+                        BOOST_FOREACH(const CTxIn& in, tx.vin){
+                            if(!mapLockedInputs.count(in.prevout)){
+                                mapLockedInputs.insert(make_pair(in.prevout, ctx.txHash));
+                            }
                         }
                     }
-                }
 
-                // resolve conflicts
+                    // resolve conflicts
 
-                //if this tx lock was rejected, we need to remove the conflicting blocks
-                if(mapTxLockReqRejected.count((*i).second.txHash)){
-                    //reprocess the last 15 blocks
-                    ReprocessBlocks(15);
+                    //if this tx lock was rejected, we need to remove the conflicting blocks
+                    fReprocess = mapTxLockReqRejected.count((*i).second.txHash) > 0;
                 }
             }
-        }
-        return true;
+        } else
+            return false;
     }
 
+    if(fReprocess){
+        //reprocess the last 15 blocks
+        ReprocessBlocks(15);
+    }
 
-    return false;
+    return true;
 }
 
 bool CheckForConflictingLocks(CTransaction& tx)
@@ -400,6 +416,7 @@ bool CheckForConflictingLocks(CTransaction& tx)
         Blocks could have been rejected during this time, which is OK. After they cancel out, the client will
         rescan the blocks and find they're acceptable and then take the chain with the most work.
     */
+    AssertLockHeld(cs_main);
     BOOST_FOREACH(const CTxIn& in, tx.vin){
         if(mapLockedInputs.count(in.prevout)){
             if(mapLockedInputs[in.prevout] != tx.GetHash()){
@@ -431,6 +448,7 @@ int64_t GetAverageVoteTime()
 
 void CleanTransactionLocksList()
 {
+    LOCK(cs_main);
     if(chainActive.Tip() == NULL) return;
 
     std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.begin();
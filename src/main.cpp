@@ -35,6 +35,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace boost;
@@ -76,9 +77,21 @@ CTxMemPool mempool(::minRelayTxFee);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nTxSize;
 };
 map<uint256, COrphanTx> mapOrphanTransactions;
 map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
+
+/** The orphans a single peer gave us, soonest to expire first, and their total size. */
+struct COrphanPeerUsage {
+    set<pair<int64_t, uint256> > setOrphans;
+    size_t nBytes;
+
+    COrphanPeerUsage() : nBytes(0) {}
+};
+map<NodeId, COrphanPeerUsage> mapOrphanTransactionsByPeer;
+set<pair<int64_t, uint256> > setOrphanTransactionsByExpiry;
 map<uint256, int64_t> mapRejectedBlocks;
 
 
@@ -277,6 +290,8 @@ struct CNodeState {
     int nBlocksInFlightValidHeaders;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Adaptive limit on the blocks in flight from this peer.
+    CBlockDownloadWindow window;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -356,10 +371,14 @@ void FinalizeNode(NodeId nodeid) {
 }
 
 // Requires cs_main.
-void MarkBlockAsReceived(const uint256& hash) {
+// When the block actually arrived, nodeFrom and nSize describe the delivery, which feeds the download
+// statistics of the peer if it is the one we requested the block from.
+void MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1, unsigned int nSize = 0) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (nodeFrom == itInFlight->second.first)
+            state->window.BlockReceived(itInFlight->second.second->nTime, GetTimeMicros(), nSize);
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
@@ -439,8 +458,9 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. If nothing can be fetched because the window is held back by a block in flight from
+ *  another peer, that peer and block are returned in nodeStaller and hashStalling. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, uint256& hashStalling) {
     if (count == 0)
         return;
 
@@ -476,6 +496,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    uint256 hashWaitingFor;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -506,6 +527,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        hashStalling = hashWaitingFor;
                     }
                     return;
                 }
@@ -516,6 +538,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                hashWaitingFor = pindex->GetBlockHash();
             }
         }
     }
@@ -523,6 +546,32 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
 } // anon namespace
 
+void CBlockDownloadWindow::BlockReceived(int64_t nRequested, int64_t nNow, unsigned int nSize) {
+    int64_t nLatency = std::max<int64_t>(nNow - nRequested, 1);
+    // Blocks from one peer arrive back to back, so a throughput sample covers the time since the previous
+    // delivery, or since the request if the peer was idle in between.
+    int64_t nInterval = std::max<int64_t>(nNow - std::max(nRequested, nLastBlockReceived), 1);
+    int64_t nThroughput = (int64_t)nSize * 1000000 / nInterval;
+    bool fKeepingPace = nBlockLatency == 0 || nLatency <= 2 * nBlockLatency;
+
+    nBlockLatency = nBlockLatency == 0 ? nLatency : (7 * nBlockLatency + nLatency) / 8;
+    nBlockThroughput = nBlockThroughput == 0 ? nThroughput : (7 * nBlockThroughput + nThroughput) / 8;
+    nLastBlockReceived = nNow;
+    if (fKeepingPace)
+        nBlocksInFlightMax = std::min(nBlocksInFlightMax + 1, MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    else
+        nBlocksInFlightMax = std::max(nBlocksInFlightMax - 1, MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+bool ShouldRerequestBlock(const CBlockDownloadWindow& window, int nBlocksInFlight, const CBlockDownloadWindow& windowStaller, int64_t nRequested, int64_t nNow) {
+    if (nBlocksInFlight >= window.nBlocksInFlightMax || window.nBlockLatency == 0)
+        return false;
+    // Never act on less than a quarter of the stalling timeout, so we don't thrash on a fast local network.
+    int64_t nOverdue = std::max(std::max(2 * windowStaller.nBlockLatency, 4 * window.nBlockLatency),
+                                (int64_t)BLOCK_STALLING_TIMEOUT * 1000000 / 4);
+    return nRequested < nNow - nOverdue;
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -535,6 +584,9 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksInFlightMax = state->window.nBlocksInFlightMax;
+    stats.nBlockLatency = state->window.nBlockLatency;
+    stats.nBlockThroughput = state->window.nBlockThroughput;
     return true;
 }
 
@@ -579,6 +631,8 @@ CBlockTreeDB *pblocktree = NULL;
 // mapOrphanTransactions
 //
 
+void static EraseOrphanTx(uint256 hash);
+
 bool AddOrphanTx(const CTransaction& tx, NodeId peer)
 {
     uint256 hash = tx.GetHash();
@@ -593,17 +647,32 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer)
     // 10,000 orphans, each of which is at most 5,000 bytes big is
     // at most 500 megabytes of orphans:
     unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-    if (sz > 5000)
+    if (sz > MAX_ORPHAN_TX_SIZE)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    // Keep each peer within its quota by dropping its own oldest orphans,
+    // so a single peer cannot push everyone else's orphans out of the pool.
+    map<NodeId, COrphanPeerUsage>::iterator itPeer;
+    while ((itPeer = mapOrphanTransactionsByPeer.find(peer)) != mapOrphanTransactionsByPeer.end() &&
+           itPeer->second.nBytes + sz > MAX_ORPHAN_TX_PEER_BYTES)
+        EraseOrphanTx(itPeer->second.setOrphans.begin()->second);
+
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nTxSize = sz;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
         mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
 
+    COrphanPeerUsage& usage = mapOrphanTransactionsByPeer[peer];
+    usage.setOrphans.insert(make_pair(orphan.nTimeExpire, hash));
+    usage.nBytes += sz;
+    setOrphanTransactionsByExpiry.insert(make_pair(orphan.nTimeExpire, hash));
+
     LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
              mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
     return true;
@@ -623,21 +692,28 @@ void static EraseOrphanTx(uint256 hash)
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+
+    map<NodeId, COrphanPeerUsage>::iterator itPeer = mapOrphanTransactionsByPeer.find(it->second.fromPeer);
+    if (itPeer != mapOrphanTransactionsByPeer.end())
+    {
+        itPeer->second.setOrphans.erase(make_pair(it->second.nTimeExpire, hash));
+        itPeer->second.nBytes -= it->second.nTxSize;
+        if (itPeer->second.setOrphans.empty())
+            mapOrphanTransactionsByPeer.erase(itPeer);
+    }
+    setOrphanTransactionsByExpiry.erase(make_pair(it->second.nTimeExpire, hash));
+
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
     int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
+    map<NodeId, COrphanPeerUsage>::iterator itPeer;
+    while ((itPeer = mapOrphanTransactionsByPeer.find(peer)) != mapOrphanTransactionsByPeer.end())
     {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
+        EraseOrphanTx(itPeer->second.setOrphans.begin()->second);
+        ++nErased;
     }
     if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
 }
@@ -646,14 +722,23 @@ void EraseOrphansFor(NodeId peer)
 unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
 {
     unsigned int nEvicted = 0;
+
+    // Drop orphans whose parents never showed up
+    int64_t nNow = GetTime();
+    while (!setOrphanTransactionsByExpiry.empty() && setOrphanTransactionsByExpiry.begin()->first <= nNow)
+    {
+        EraseOrphanTx(setOrphanTransactionsByExpiry.begin()->second);
+        ++nEvicted;
+    }
+
     while (mapOrphanTransactions.size() > nMaxOrphans)
     {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        // Evict the oldest orphan of the peer that uses the most orphan memory
+        map<NodeId, COrphanPeerUsage>::iterator itHeaviest = mapOrphanTransactionsByPeer.begin();
+        for (map<NodeId, COrphanPeerUsage>::iterator it = itHeaviest; it != mapOrphanTransactionsByPeer.end(); ++it)
+            if (it->second.nBytes > itHeaviest->second.nBytes)
+                itHeaviest = it;
+        EraseOrphanTx(itHeaviest->second.setOrphans.begin()->second);
         ++nEvicted;
     }
     return nEvicted;
@@ -667,34 +752,11 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
 
 bool IsStandardTx(const CTransaction& tx, string& reason)
 {
-    AssertLockHeld(cs_main);
     if (tx.nVersion > CTransaction::CURRENT_VERSION || tx.nVersion < 1) {
         reason = "version";
         return false;
     }
 
-    // Treat non-final transactions as non-standard to prevent a specific type
-    // of double-spend attack, as well as DoS attacks. (if the transaction
-    // can't be mined, the attacker isn't expending resources broadcasting it)
-    // Basically we don't want to propagate transactions that can't be included in
-    // the next block.
-    //
-    // However, IsFinalTx() is confusing... Without arguments, it uses
-    // chainActive.Height() to evaluate nLockTime; when a block is accepted, chainActive.Height()
-    // is set to the value of nHeight in the block. However, when IsFinalTx()
-    // is called within CBlock::AcceptBlock(), the height of the block *being*
-    // evaluated is what is used. Thus if we want to know if a transaction can
-    // be part of the *next* block, we need to call IsFinalTx() with one more
-    // than chainActive.Height().
-    //
-    // Timestamps on the other hand don't get any special treatment, because we
-    // can't know what timestamp the next block will have, and there aren't
-    // timestamp applications where it matters.
-    if (!IsFinalTx(tx, chainActive.Height() + 1)) {
-        reason = "non-final";
-        return false;
-    }
-
     // Extremely large transactions with lots of inputs can cost the network
     // almost as much to process as they cost the sender in fees, because
     // computing signature hashes is O(ninputs*txsize). Limiting transactions
@@ -1009,13 +1071,8 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+bool PreCheckTransaction(const CTransaction& tx, CValidationState& state)
 {
-    AssertLockHeld(cs_main);
-    if (pfMissingInputs)
-        *pfMissingInputs = false;
-
     if (!CheckTransaction(tx, state))
         return error("AcceptToMemoryPool: : CheckTransaction failed");
 
@@ -1031,6 +1088,41 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                          error("AcceptToMemoryPool : nonstandard transaction: %s", reason),
                          REJECT_NONSTANDARD, reason);
 
+    return true;
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees, bool fPreChecked)
+{
+    AssertLockHeld(cs_main);
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+
+    if (!fPreChecked && !PreCheckTransaction(tx, state))
+        return false;
+
+    // Treat non-final transactions as non-standard to prevent a specific type
+    // of double-spend attack, as well as DoS attacks. (if the transaction
+    // can't be mined, the attacker isn't expending resources broadcasting it)
+    // Basically we don't want to propagate transactions that can't be included in
+    // the next block.
+    //
+    // However, IsFinalTx() is confusing... Without arguments, it uses
+    // chainActive.Height() to evaluate nLockTime; when a block is accepted, chainActive.Height()
+    // is set to the value of nHeight in the block. However, when IsFinalTx()
+    // is called within CBlock::AcceptBlock(), the height of the block *being*
+    // evaluated is what is used. Thus if we want to know if a transaction can
+    // be part of the *next* block, we need to call IsFinalTx() with one more
+    // than chainActive.Height().
+    //
+    // Timestamps on the other hand don't get any special treatment, because we
+    // can't know what timestamp the next block will have, and there aren't
+    // timestamp applications where it matters.
+    if (Params().RequireStandard() && !IsFinalTx(tx, chainActive.Height() + 1))
+        return state.DoS(0,
+                         error("AcceptToMemoryPool : nonstandard transaction: non-final"),
+                         REJECT_NONSTANDARD, "non-final");
+
     // is it already in the memory pool?
     uint256 hash = tx.GetHash();
     if (pool.exists(hash))
@@ -1042,7 +1134,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         if(mapLockedInputs.count(in.prevout)){
             if(mapLockedInputs[in.prevout] != tx.GetHash()){
                 return state.DoS(0,
-                                 error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", reason),
+                                 error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", in.prevout.ToString()),
                                  REJECT_INVALID, "tx-lock-conflict");
             }
         }
@@ -1111,8 +1203,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // itself can contain sigops MAX_TX_SIGOPS is less than
         // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
         // merely non-standard transaction.
-        unsigned int nSigOps = GetLegacySigOpCount(tx);
-        nSigOps += GetP2SHSigOpCount(tx, view);
+        unsigned int nP2SHSigOps = GetP2SHSigOpCount(tx, view);
+        unsigned int nSigOps = GetLegacySigOpCount(tx) + nP2SHSigOps;
         if (nSigOps > MAX_TX_SIGOPS)
             return state.DoS(0,
                              error("AcceptToMemoryPool : too many sigops %s, %d > %d",
@@ -1123,7 +1215,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), nP2SHSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1306,8 +1398,8 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState &state, const CTransact
         // itself can contain sigops MAX_TX_SIGOPS is less than
         // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
         // merely non-standard transaction.
-        unsigned int nSigOps = GetLegacySigOpCount(tx);
-        nSigOps += GetP2SHSigOpCount(tx, view);
+        unsigned int nP2SHSigOps = GetP2SHSigOpCount(tx, view);
+        unsigned int nSigOps = GetLegacySigOpCount(tx) + nP2SHSigOps;
         if (nSigOps > MAX_TX_SIGOPS)
             return state.DoS(0,
                              error("AcceptableInputs : too many sigops %s, %d > %d",
@@ -1318,7 +1410,7 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState &state, const CTransact
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), nP2SHSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1545,12 +1637,10 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
    both a block and its header.  */
 
 template<typename T>
-static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos)
+static bool ReadBlockOrHeader(T& block, CAutoFile& filein)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk : OpenBlockFile failed");
 
@@ -1569,6 +1659,14 @@ static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos)
     return true;
 }
 
+template<typename T>
+static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos)
+{
+    // Open history file to read
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    return ReadBlockOrHeader(block, filein);
+}
+
 template<typename T>
 static bool ReadBlockOrHeader(T& block, const CBlockIndex* pindex)
 {
@@ -1818,13 +1916,13 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore, txdata), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks, const PrecomputedTransactionData *ptxdata)
 {
     if (!tx.IsCoinBase())
     {
@@ -1887,13 +1985,22 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Serialize the signature hash parts all inputs share once;
+            // checks deferred to pvChecks need the caller's copy to outlive them
+            assert(ptxdata || !pvChecks);
+            boost::scoped_ptr<PrecomputedTransactionData> txdataLocal;
+            if (!ptxdata && tx.vin.size() > 1) {
+                txdataLocal.reset(new PrecomputedTransactionData(tx));
+                ptxdata = txdataLocal.get();
+            }
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins* coins = inputs.AccessCoins(prevout.hash);
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(*coins, tx, i, flags, cacheStore, ptxdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1906,7 +2013,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, ptxdata);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -2080,6 +2187,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
+    // Shared signature hash data of each transaction; declared before control
+    // so that it outlives the queued script checks. Reserved so that it never
+    // reallocates under them.
+    std::vector<PrecomputedTransactionData> vTxData;
+    vTxData.reserve(block.vtx.size());
+
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
@@ -2118,7 +2231,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, nScriptCheckThreads ? &vChecks : NULL))
+            const PrecomputedTransactionData *ptxdata = NULL;
+            if (fScriptChecks && nScriptCheckThreads) {
+                vTxData.push_back(PrecomputedTransactionData(tx));
+                ptxdata = &vTxData.back();
+            }
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, nScriptCheckThreads ? &vChecks : NULL, ptxdata))
                 return false;
             control.Add(vChecks);
         }
@@ -3277,12 +3395,13 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDis
 {
     // Preliminary checks
     bool checked = CheckBlock(*pblock, state);
+    unsigned int nBlockSize = pfrom ? ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION) : 0;
 
     while(true) {
         TRY_LOCK(cs_main, lockMain);
         if(!lockMain) { MilliSleep(50); continue; }
 
-        MarkBlockAsReceived(pblock->GetHash());
+        MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1, nBlockSize);
         if (!checked) {
             return error("%s : CheckBlock FAILED", __func__);
         }
@@ -3983,6 +4102,37 @@ string GetWarnings(string strFor)
 // Messages
 //
 
+/**
+ * Message handler threads take one of two lanes before processing a message.
+ * The core lane covers everything ProcessMessage handles itself, the side lane
+ * the throne, darksend, budget, instantx and spork managers, which keep their
+ * own state and would otherwise wait behind cs_main-bound work such as
+ * serving blocks. Each lane admits one message at a time, so code on either
+ * side still runs as if from a single thread. The core lane may wait for the
+ * side lane when it reads manager state, never the other way around, and
+ * both are taken before cs_main.
+ */
+static CCriticalSection cs_coreLane;
+static CCriticalSection cs_sideLane;
+
+bool static IsSideLaneCommand(const string& strCommand)
+{
+    static const char* const pszCoreCommands[] = {
+        "version", "verack", "addr", "inv", "getdata", "getblocks", "getheaders",
+        "tx", "dstx", "headers", "block", "getaddr", "mempool", "ping", "pong",
+        "alert", "filterload", "filteradd", "filterclear", "reject"
+    };
+    for (unsigned int i = 0; i < ARRAYLEN(pszCoreCommands); i++)
+        if (strCommand == pszCoreCommands[i])
+            return false;
+    return true;
+}
+
+/** Whether looking up inv touches state owned by the side lane */
+bool static IsSideLaneInv(const CInv& inv)
+{
+    return inv.type != MSG_TX && inv.type != MSG_BLOCK && inv.type != MSG_FILTERED_BLOCK;
+}
 
 bool static AlreadyHave(const CInv& inv)
 {
@@ -4050,13 +4200,54 @@ bool static AlreadyHave(const CInv& inv)
 }
 
 
+/** Blocks older than this (in seconds) below our tip are served as historical blocks by the upload limiter. */
+static const int64_t UPLOAD_HISTORICAL_BLOCK_AGE = 24 * 60 * 60;
+
+/** Upload limiter class of a requested item. Requires cs_main. */
+static UploadClass GetUploadClass(const CInv& inv)
+{
+    if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+        BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+        if (mi != mapBlockIndex.end() && mi->second->GetBlockTime() < chainActive.Tip()->GetBlockTime() - UPLOAD_HISTORICAL_BLOCK_AGE)
+            return UPLOAD_HISTORICAL_BLOCK;
+    } else if (inv.type == MSG_THRONE_ANNOUNCE || inv.type == MSG_THRONE_PING) {
+        return UPLOAD_THRONE_LIST;
+    }
+    return UPLOAD_BLOCK_RELAY;
+}
+
+/** Maximum number of consecutive block requests served in one go before other messages get a turn. */
+static const unsigned int MAX_GETDATA_BLOCK_BATCH = 16;
+
+/** A requested block, resolved under cs_main and read from disk after releasing it. */
+struct CGetDataBlock
+{
+    CInv inv;
+    CDiskBlockPos pos;
+    bool fContinue; //! Whether to follow it with an inv of our tip, see hashContinue
+};
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
 
     vector<CInv> vNotFound;
+    vector<CGetDataBlock> vBlocks;
+    uint256 hashTip;
+    CMessageBatch batch(pfrom);
+
+    boost::scoped_ptr<CCriticalBlock> lockSide;
+    BOOST_FOREACH(const CInv& inv, pfrom->vRecvGetData) {
+        if (IsSideLaneInv(inv)) {
+            lockSide.reset(new CCriticalBlock(cs_sideLane, "cs_sideLane", __FILE__, __LINE__));
+            break;
+        }
+    }
 
-    LOCK(cs_main);
+    boost::scoped_ptr<CCriticalBlock> lockMain(new CCriticalBlock(cs_main, "cs_main", __FILE__, __LINE__));
+
+    bool fLimitUpload = !pfrom->fWhitelisted && uploadLimiter.IsLimited();
+    pfrom->fUploadThrottled = false;
 
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -4064,11 +4255,21 @@ void static ProcessGetData(CNode* pfrom)
             break;
 
         const CInv &inv = *it;
+        // Leave the rest of the request queued while the upload limiter holds this item back
+        if (fLimitUpload && !uploadLimiter.Allow(GetUploadClass(inv), GetTimeMicros())) {
+            pfrom->fUploadThrottled = true;
+            break;
+        }
+        // Blocks are only looked up here and read from disk below, after releasing cs_main. A run
+        // of block requests is served in one go, anything after it waits for the next call.
+        bool fBlock = inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK;
+        if (!vBlocks.empty() && (!fBlock || vBlocks.size() >= MAX_GETDATA_BLOCK_BATCH))
+            break;
         {
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (fBlock)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -4089,68 +4290,40 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
-                    {
-                        LOCK(pfrom->cs_filter);
-                        if (pfrom->pfilter)
-                        {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
-                            pfrom->PushMessage("merkleblock", merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didnt send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
-                                    pfrom->PushMessage("tx", block.vtx[pair.first]);
-                        }
-                        // else
-                            // no response
-                    }
-
-                    // Trigger them to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
-                    {
-                        // Bypass PushInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        pfrom->PushMessage("inv", vInv);
+                    CGetDataBlock request;
+                    request.inv = inv;
+                    request.pos = mi->second->GetBlockPos();
+                    request.fContinue = (inv.hash == pfrom->hashContinue);
+                    if (request.fContinue)
                         pfrom->hashContinue.SetNull();
-                    }
+                    vBlocks.push_back(request);
+                    continue;
                 }
             }
             else if (inv.IsKnownType())
             {
-                // Send stream from relay memory
+                // Send message from relay memory, serialized once for all
+                // peers asking for it
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSerializeDataRef>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushSharedMessage(inv.type == MSG_TXLOCK_REQUEST ? "ix" : inv.GetCommand(), (*mi).second);
                         pushed = true;
                     }
                 }
 
-                if (!pushed && inv.type == MSG_TX) {
+                if (!pushed && inv.type == MSG_TX && mempool.exists(inv.hash)) {
 
+                    CSerializeDataRef msg = GetCachedMessage(inv);
                     CTransaction tx;
-                    if (mempool.lookup(inv.hash, tx)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << tx;
-                        pfrom->PushMessage("tx", ss);
+                    if (!msg && mempool.lookup(inv.hash, tx)) {
+                        msg = CNode::MakeMessage("tx", tx);
+                        CacheMessage(inv, msg);
+                    }
+                    if (msg) {
+                        pfrom->PushSharedMessage("tx", msg);
                         pushed = true;
                     }
                 }
@@ -4159,7 +4332,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << mapTxLockVote[inv.hash];
-                        pfrom->PushMessage("txlvote", ss);
+                        batch.PushMessage("txlvote", ss);
                         pushed = true;
                     }
                 }
@@ -4168,7 +4341,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << mapTxLockReq[inv.hash];
-                        pfrom->PushMessage("ix", ss);
+                        batch.PushMessage("ix", ss);
                         pushed = true;
                     }
                 }
@@ -4177,7 +4350,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << mapSporks[inv.hash];
-                        pfrom->PushMessage("spork", ss);
+                        batch.PushMessage("spork", ss);
                         pushed = true;
                     }
                 }
@@ -4186,7 +4359,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << thronePayments.mapThronePayeeVotes[inv.hash];
-                        pfrom->PushMessage("mnw", ss);
+                        batch.PushMessage("mnw", ss);
                         pushed = true;
                     }
                 }
@@ -4195,7 +4368,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << budget.mapSeenThroneBudgetVotes[inv.hash];
-                        pfrom->PushMessage("mvote", ss);
+                        batch.PushMessage("mvote", ss);
                         pushed = true;
                     }
                 }
@@ -4205,7 +4378,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << budget.mapSeenThroneBudgetProposals[inv.hash];
-                        pfrom->PushMessage("mprop", ss);
+                        batch.PushMessage("mprop", ss);
                         pushed = true;
                     }
                 }
@@ -4215,7 +4388,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << budget.mapSeenFinalizedBudgetVotes[inv.hash];
-                        pfrom->PushMessage("fbvote", ss);
+                        batch.PushMessage("fbvote", ss);
                         pushed = true;
                     }
                 }
@@ -4225,7 +4398,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << budget.mapSeenFinalizedBudgets[inv.hash];
-                        pfrom->PushMessage("fbs", ss);
+                        batch.PushMessage("fbs", ss);
                         pushed = true;
                     }
                 }
@@ -4235,7 +4408,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << mnodeman.mapSeenThroneBroadcast[inv.hash];
-                        pfrom->PushMessage("mnb", ss);
+                        batch.PushMessage("mnb", ss);
                         pushed = true;
                     }
                 }
@@ -4245,7 +4418,7 @@ void static ProcessGetData(CNode* pfrom)
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << mnodeman.mapSeenThronePing[inv.hash];
-                        pfrom->PushMessage("mnp", ss);
+                        batch.PushMessage("mnp", ss);
                         pushed = true;
                     }
                 }
@@ -4273,14 +4446,102 @@ void static ProcessGetData(CNode* pfrom)
 
             // Track requests for our stuff.
             g_signals.Inventory(inv.hash);
+        }
+    }
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
-                break;
+    if (!vBlocks.empty())
+        hashTip = chainActive.Tip()->GetBlockHash();
+    lockMain.reset();
+    batch.Flush();
+
+    // The data at a block's position never changes once written, so it is read without cs_main.
+    // Consecutive blocks mostly sit back to back in one file, which is opened once and read
+    // front to back so the OS read-ahead covers them.
+    boost::scoped_ptr<CAutoFile> pfileBlocks;
+    int nFileBlocks = -1;
+    size_t nServed = 0;
+    for (; nServed < vBlocks.size(); nServed++) {
+        if (nServed > 0 && pfrom->nSendSize >= SendBufferSize())
+            break;
+        const CGetDataBlock& request = vBlocks[nServed];
+
+        // New blocks are requested by most peers in a row, serialize them once
+        CSerializeDataRef msg;
+        if (request.inv.type == MSG_BLOCK)
+            msg = GetCachedMessage(request.inv);
+        CBlock block;
+        if (!msg) {
+            if (request.pos.nFile != nFileBlocks) {
+                pfileBlocks.reset(new CAutoFile(OpenBlockFile(request.pos, true), SER_DISK, CLIENT_VERSION));
+                nFileBlocks = request.pos.nFile;
+            } else if (!pfileBlocks->IsNull()) {
+                fseek(pfileBlocks->Get(), request.pos.nPos, SEEK_SET);
+            }
+            if (!ReadBlockOrHeader(block, *pfileBlocks) || block.GetHash() != request.inv.hash)
+                assert(!"cannot load block from disk");
+        }
+
+        if (request.inv.type == MSG_BLOCK)
+        {
+            if (!msg) {
+                msg = CNode::MakeMessage("block", block);
+                CacheMessage(request.inv, msg);
+            }
+            pfrom->PushSharedMessage("block", msg);
         }
+        else // MSG_FILTERED_BLOCK)
+        {
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter)
+            {
+                CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                pfrom->PushMessage("merkleblock", merkleBlock);
+                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                // This avoids hurting performance by pointlessly requiring a round-trip
+                // Note that there is currently no way for a node to request any single transactions we didnt send here -
+                // they must either disconnect and retry or request the full block.
+                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                // however we MUST always provide at least what the remote peer needs
+                typedef std::pair<unsigned int, uint256> PairType;
+                std::vector<unsigned int> vUnknownTxn;
+                {
+                    // Side lane handlers may add to the peer's known inventory concurrently
+                    LOCK(pfrom->cs_inventory);
+                    BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                        if (!pfrom->IsInventoryKnown(CInv(MSG_TX, pair.second)))
+                            vUnknownTxn.push_back(pair.first);
+                }
+                BOOST_FOREACH(unsigned int nTx, vUnknownTxn)
+                    pfrom->PushMessage("tx", block.vtx[nTx]);
+            }
+            // else
+                // no response
+        }
+
+        // Trigger them to send a getblocks request for the next batch of inventory
+        if (request.fContinue)
+        {
+            // Bypass PushInventory, this must send even if redundant,
+            // and we want it right after the last block so they don't
+            // wait for other stuff first.
+            vector<CInv> vInv;
+            vInv.push_back(CInv(MSG_BLOCK, hashTip));
+            pfrom->PushMessage("inv", vInv);
+        }
+
+        // Track requests for our stuff.
+        g_signals.Inventory(request.inv.hash);
     }
 
     pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
 
+    // Requeue the blocks the send buffer had no room for
+    for (size_t i = vBlocks.size(); i > nServed; i--) {
+        pfrom->vRecvGetData.push_front(vBlocks[i - 1].inv);
+        if (vBlocks[i - 1].fContinue)
+            pfrom->hashContinue = vBlocks[i - 1].inv.hash;
+    }
+
     if (!vNotFound.empty()) {
         // Let the peer know that we didn't find what it asked for, so it doesn't
         // have to wait around forever. Currently only SPV clients actually care
@@ -4293,6 +4554,237 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/**
+ * Hand a transaction received from a peer to the memory pool. PreCheckTransaction
+ * must already have run, with its result in state. Relays the transaction,
+ * resolves orphans that were waiting for it and rejects or punishes the peer
+ * as needed.
+ */
+static void ProcessTransaction(CNode* pfrom, const string& strCommand, const CTransaction& tx, CValidationState& state, bool ignoreFees)
+{
+    vector<uint256> vWorkQueue;
+    CInv inv(MSG_TX, tx.GetHash());
+    pfrom->AddInventoryKnown(inv);
+
+    LOCK(cs_main);
+
+    bool fMissingInputs = false;
+
+    mapAlreadyAskedFor.erase(inv);
+
+    if (state.IsValid() && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, ignoreFees, true))
+    {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx);
+        vWorkQueue.push_back(inv.hash);
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s : accepted %s (poolsz %u)\n",
+            pfrom->id, pfrom->cleanSubVer,
+            tx.GetHash().ToString(),
+            mempool.mapTx.size());
+
+        // Recursively process any orphan transactions that depended on this one,
+        // breadth-first, straight from the already deserialized orphan pool
+        set<NodeId> setMisbehaving;
+        set<uint256> setErase;
+        for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+        {
+            map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            for (set<uint256>::iterator mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end();
+                 ++mi)
+            {
+                const uint256& orphanHash = *mi;
+                // Already accepted or dropped while handling another parent
+                if (setErase.count(orphanHash))
+                    continue;
+                const COrphanTx& orphan = mapOrphanTransactions[orphanHash];
+                const CTransaction& orphanTx = orphan.tx;
+                NodeId fromPeer = orphan.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
+                {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx);
+                    vWorkQueue.push_back(orphanHash);
+                    setErase.insert(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    setErase.insert(orphanHash);
+                }
+            }
+        }
+        if (!setErase.empty())
+            mempool.check(pcoinsTip);
+
+        BOOST_FOREACH(const uint256& hash, setErase)
+            EraseOrphanTx(hash);
+    }
+    else if (fMissingInputs)
+    {
+        AddOrphanTx(tx, pfrom->GetId());
+
+        // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+        unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+        unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+        if (nEvicted > 0)
+            LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+    } else if (pfrom->fWhitelisted) {
+        // Always relay transactions received from whitelisted peers, even
+        // if they are already in the mempool (allowing the node to function
+        // as a gateway for nodes hidden behind it).
+
+        RelayTransaction(tx);
+    }
+
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
+            pfrom->id, pfrom->cleanSubVer,
+            state.GetRejectReason());
+        pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
+/**
+ * Transactions from "tx" messages are deserialized and put through
+ * PreCheckTransaction by a pool of ThreadTxPreCheck workers fed by all peers.
+ * The message handler thread picks up the results in
+ * ProcessPreCheckedTransactions and only runs the rest of AcceptToMemoryPool
+ * under cs_main.
+ */
+struct CTxPreCheck
+{
+    CNode* pfrom;
+    CDataStream vRecv;
+    CTransaction tx;
+    CValidationState state;
+    unsigned int nMessageSize; //! Size of the message before deserialization consumed it
+    std::string strMalformed; //! Set if the message could not be deserialized
+
+    CTxPreCheck(CNode* pfromIn, const CDataStream& vRecvIn) : pfrom(pfromIn), vRecv(vRecvIn), nMessageSize(vRecvIn.size())
+    {
+        pfrom->AddRef();
+    }
+
+    ~CTxPreCheck()
+    {
+        pfrom->Release();
+    }
+};
+
+/** Past this many queued transactions the message handler checks them itself, which throttles the peers */
+static const unsigned int MAX_TXPRECHECK_PENDING = 1000;
+
+static boost::mutex csTxPreCheck;
+static boost::condition_variable condTxPreCheck;
+static std::deque<CTxPreCheck*> vTxPreCheckPending;
+static std::deque<CTxPreCheck*> vTxPreCheckDone;
+
+static bool QueueTxPreCheck(CNode* pfrom, const CDataStream& vRecv)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csTxPreCheck);
+        if (vTxPreCheckPending.size() >= MAX_TXPRECHECK_PENDING)
+            return false;
+        vTxPreCheckPending.push_back(new CTxPreCheck(pfrom, vRecv));
+    }
+    condTxPreCheck.notify_one();
+    return true;
+}
+
+void ThreadTxPreCheck()
+{
+    RenameThread("terracoin-txcheck");
+    while (true) {
+        CTxPreCheck* pcheck;
+        {
+            boost::unique_lock<boost::mutex> lock(csTxPreCheck);
+            while (vTxPreCheckPending.empty())
+                condTxPreCheck.wait(lock);
+            pcheck = vTxPreCheckPending.front();
+            vTxPreCheckPending.pop_front();
+        }
+
+        try {
+            pcheck->vRecv >> pcheck->tx;
+            PreCheckTransaction(pcheck->tx, pcheck->state);
+        } catch (const std::exception& e) {
+            pcheck->strMalformed = e.what();
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(csTxPreCheck);
+            vTxPreCheckDone.push_back(pcheck);
+        }
+        messageHandlerCondition.notify_one();
+    }
+}
+
+static void ProcessPreCheckedTransactions()
+{
+    std::deque<CTxPreCheck*> vDone;
+    {
+        boost::unique_lock<boost::mutex> lock(csTxPreCheck);
+        vDone.swap(vTxPreCheckDone);
+    }
+    if (vDone.empty())
+        return;
+
+    LOCK(cs_main);
+    BOOST_FOREACH(CTxPreCheck* pcheck, vDone) {
+        CNode* pfrom = pcheck->pfrom;
+        if (!pcheck->strMalformed.empty()) {
+            pfrom->PushMessage("reject", string("tx"), REJECT_MALFORMED, string("error parsing message"));
+            LogPrintf("ProcessMessages(tx, %u bytes): Exception '%s' caught\n", pcheck->nMessageSize, pcheck->strMalformed);
+        } else {
+            try {
+                ProcessTransaction(pfrom, "tx", pcheck->tx, pcheck->state, false);
+            } catch (std::exception& e) {
+                PrintExceptionContinue(&e, "ProcessPreCheckedTransactions()");
+            }
+        }
+        delete pcheck;
+    }
+}
+
+void StopTxPreCheck()
+{
+    boost::unique_lock<boost::mutex> lock(csTxPreCheck);
+    BOOST_FOREACH(CTxPreCheck* pcheck, vTxPreCheckPending)
+        delete pcheck;
+    vTxPreCheckPending.clear();
+    BOOST_FOREACH(CTxPreCheck* pcheck, vTxPreCheckDone)
+        delete pcheck;
+    vTxPreCheckDone.clear();
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -4474,7 +4966,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 {
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
-                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
+                    // at a time so the filterAddrKnowns of the chosen nodes prevent repeats
                     static uint256 hashSalt;
                     if (hashSalt.IsNull())
                         hashSalt = GetRandHash();
@@ -4519,6 +5011,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return error("message inv size() = %u", vInv.size());
         }
 
+        boost::scoped_ptr<CCriticalBlock> lockSide;
+        BOOST_FOREACH(const CInv& inv, vInv) {
+            if (IsSideLaneInv(inv)) {
+                lockSide.reset(new CCriticalBlock(cs_sideLane, "cs_sideLane", __FILE__, __LINE__));
+                break;
+            }
+        }
+
         LOCK(cs_main);
 
         std::vector<CInv> vToFetch;
@@ -4551,7 +5051,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                        nodestate->nBlocksInFlight < nodestate->window.nBlocksInFlightMax) {
                         vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
@@ -4674,10 +5174,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "tx" && nScriptCheckThreads && QueueTxPreCheck(pfrom, vRecv))
+    {
+        // Handed to the pre-check workers, accepted later by ProcessPreCheckedTransactions
+    }
+
+
     else if (strCommand == "tx"|| strCommand == "dstx")
     {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
 
         //throne signed transaction
@@ -4692,6 +5196,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             //these allow thrones to publish a limited amount of free transactions
             vRecv >> tx >> vin >> vchSig >> sigTime;
 
+            LOCK(cs_sideLane);
+
             CThrone* pmn = mnodeman.Find(vin);
             if(pmn != NULL)
             {
@@ -4727,112 +5233,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
         }
 
-        CInv inv(MSG_TX, tx.GetHash());
-        pfrom->AddInventoryKnown(inv);
-
-        LOCK(cs_main);
-
-        bool fMissingInputs = false;
         CValidationState state;
-
-        mapAlreadyAskedFor.erase(inv);
-
-        if (AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, ignoreFees))
-        {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s : accepted %s (poolsz %u)\n",
-                pfrom->id, pfrom->cleanSubVer,
-                tx.GetHash().ToString(),
-                mempool.mapTx.size());
-
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
-        {
-            AddOrphanTx(tx, pfrom->GetId());
-
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-        } else if (pfrom->fWhitelisted) {
-            // Always relay transactions received from whitelisted peers, even
-            // if they are already in the mempool (allowing the node to function
-            // as a gateway for nodes hidden behind it).
-
-            RelayTransaction(tx);
-        }
+        PreCheckTransaction(tx, state);
+        ProcessTransaction(pfrom, strCommand, tx, state, ignoreFees);
 
         if(strCommand == "dstx"){
             CInv inv(MSG_DSTX, tx.GetHash());
             RelayInv(inv);
         }
-
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
-                pfrom->id, pfrom->cleanSubVer,
-                state.GetRejectReason());
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-        }
     }
 
 
@@ -5143,6 +5551,34 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
         }
     }
+    else if (strCommand == "batch")
+    {
+        // Process the messages packed into the envelope in order. It is handled on the
+        // side lane, so only the side lane items a sender may batch are accepted.
+        CDataStream vEntries(vRecv.GetType(), vRecv.GetVersion());
+        if (!CMessageBatch::Unpack(vRecv, vEntries))
+        {
+            LogPrint("net", "batch: malformed envelope from peer=%d\n", pfrom->id);
+            { LOCK(cs_main); Misbehaving(pfrom->GetId(), 20); }
+            return false;
+        }
+        unsigned int nMessages = 0;
+        while (!vEntries.empty())
+        {
+            string strBatchCommand;
+            vector<unsigned char> vPayload;
+            vEntries >> LIMITED_STRING(strBatchCommand, CMessageHeader::COMMAND_SIZE) >> vPayload;
+            if (!CMessageBatch::IsBatchable(strBatchCommand) || ++nMessages > MAX_BATCH_MESSAGES)
+            {
+                LogPrint("net", "batch: unexpected %s from peer=%d\n", SanitizeString(strBatchCommand), pfrom->id);
+                { LOCK(cs_main); Misbehaving(pfrom->GetId(), 20); }
+                return false;
+            }
+            CDataStream vBatchRecv(vPayload, vRecv.GetType(), vRecv.GetVersion());
+            if (!ProcessMessage(pfrom, strBatchCommand, vBatchRecv, nTimeReceived))
+                return false;
+        }
+    }
     else
     {
         //probably one the extensions
@@ -5175,12 +5611,29 @@ bool ProcessMessages(CNode* pfrom)
     //  (x) data
     //
     bool fOk = true;
+    bool fLaneUsed = false;
+    pfrom->fRecvLaneBusy = false;
 
-    if (!pfrom->vRecvGetData.empty())
-        ProcessGetData(pfrom);
+    {
+        TRY_LOCK(cs_coreLane, lockCore);
+        if (lockCore) {
+            ProcessPreCheckedTransactions();
+
+            if (!pfrom->vRecvGetData.empty()) {
+                ProcessGetData(pfrom);
+                fLaneUsed = true;
+            }
+        } else if (!pfrom->vRecvGetData.empty()) {
+            pfrom->fRecvLaneBusy = true;
+        }
+    }
 
     // this maintains the order of responses
-    if (!pfrom->vRecvGetData.empty()) return fOk;
+    if (!pfrom->vRecvGetData.empty()) {
+        if (fLaneUsed)
+            messageHandlerCondition.notify_all();
+        return fOk;
+    }
 
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
@@ -5200,6 +5653,14 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // leave the message at the head of the queue if its lane is taken,
+        // the peer's later messages must not overtake it
+        TRY_LOCK(IsSideLaneCommand(msg.hdr.GetCommand()) ? cs_sideLane : cs_coreLane, lockLane);
+        if (!lockLane) {
+            pfrom->fRecvLaneBusy = true;
+            break;
+        }
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -5224,7 +5685,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Checksum
         CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+        uint256 hash = msg.GetMessageHash();
         unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
         if (nChecksum != hdr.nChecksum)
         {
@@ -5270,9 +5731,14 @@ bool ProcessMessages(CNode* pfrom)
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
 
+        fLaneUsed = true;
         break;
     }
 
+    // wake handler threads that found a lane taken
+    if (fLaneUsed)
+        messageHandlerCondition.notify_all();
+
     // In case the connection got shut down, its receive buffer was wiped
     if (!pfrom->fDisconnect)
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
@@ -5328,9 +5794,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LOCK(cs_vNodes);
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
-                // Periodically clear setAddrKnown to allow refresh broadcasts
+                // Periodically clear filterAddrKnown to allow refresh broadcasts
                 if (nLastRebroadcast)
-                    pnode->setAddrKnown.clear();
+                    pnode->filterAddrKnown.clear();
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -5348,9 +5814,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second)
+                if (!pto->IsAddressKnown(addr))
                 {
+                    pto->AddAddressKnown(addr);
                     vAddr.push_back(addr);
                     // receiver rejects addr messages larger than 1000
                     if (vAddr.size() >= 1000)
@@ -5412,37 +5878,68 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: inventory
         //
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
+            vInv.reserve(std::min<size_t>(1000, pto->vInventoryToSend.size() + INVENTORY_BROADCAST_MAX));
+
+            // Blocks and throne/budget/instantx inventory go out right away
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->IsInventoryKnown(inv))
                     continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+                pto->filterInventoryKnown.insert(CNode::GetInventoryKey(inv));
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000)
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
-
-                    if (fTrickleWait)
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
+                }
+            }
+            pto->vInventoryToSend.clear();
+
+            // Transactions are announced in feerate-ordered batches on a
+            // Poisson timer, which protects privacy and lets us collapse the
+            // relay of a burst into a few inv messages.
+            int64_t nNow = GetTimeMicros();
+            bool fSendTxs = pto->fWhitelisted;
+            if (pto->nNextInvSend < nNow) {
+                fSendTxs = true;
+                pto->nNextInvSend = PoissonNextSend(nNow, pto->fInbound ? AVG_INVENTORY_BROADCAST_INTERVAL : AVG_INVENTORY_BROADCAST_INTERVAL >> 1);
+            }
+            if (fSendTxs && !pto->setInventoryTxToSend.empty())
+            {
+                vector<pair<CFeeRate, uint256> > vTxToSend;
+                vTxToSend.reserve(pto->setInventoryTxToSend.size());
+                {
+                    LOCK(mempool.cs);
+                    BOOST_FOREACH(const uint256& hash, pto->setInventoryTxToSend)
                     {
-                        vInvWait.push_back(inv);
-                        continue;
+                        if (pto->IsInventoryKnown(CInv(MSG_TX, hash)))
+                            continue;
+                        // Transactions relayed without being in our pool
+                        // (e.g. from mapRelay only) go last.
+                        CFeeRate feeRate;
+                        map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.find(hash);
+                        if (mi != mempool.mapTx.end())
+                            feeRate = CFeeRate(mi->second.GetFee(), mi->second.GetTxSize());
+                        vTxToSend.push_back(make_pair(feeRate, hash));
                     }
                 }
+                pto->setInventoryTxToSend.clear();
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+                size_t nToSend = std::min<size_t>(vTxToSend.size(), INVENTORY_BROADCAST_MAX);
+                std::partial_sort(vTxToSend.begin(), vTxToSend.begin() + nToSend, vTxToSend.end(),
+                                  std::greater<pair<CFeeRate, uint256> >());
+                for (size_t i = 0; i < vTxToSend.size(); i++)
                 {
+                    const uint256& hash = vTxToSend[i].second;
+                    // Whatever does not fit into this batch waits for the next one
+                    if (i >= nToSend) {
+                        pto->setInventoryTxToSend.insert(hash);
+                        continue;
+                    }
+                    CInv inv(MSG_TX, hash);
+                    pto->filterInventoryKnown.insert(CNode::GetInventoryKey(inv));
                     vInv.push_back(inv);
                     if (vInv.size() >= 1000)
                     {
@@ -5451,7 +5948,6 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
             }
-            pto->vInventoryToSend = vInvWait;
         }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
@@ -5492,16 +5988,33 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.window.nBlocksInFlightMax) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            uint256 hashStalling;
+            FindNextBlocksToDownload(pto->GetId(), state.window.nBlocksInFlightMax - state.nBlocksInFlight, vToDownload, staller, hashStalling);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
                 LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->id);
             }
+            if (staller != -1) {
+                // Rather than waiting for a slow peer to hold the window back until it gets disconnected,
+                // move the block it is sitting on to this peer if it has proven faster. The staller's
+                // window is halved so it gets fewer blocks it can hold up in the future.
+                CNodeState *stateStaller = State(staller);
+                const QueuedBlock& queuedStalling = *mapBlocksInFlight[hashStalling].second;
+                if (ShouldRerequestBlock(state.window, state.nBlocksInFlight, stateStaller->window, queuedStalling.nTime, nNow)) {
+                    CBlockIndex *pindexStalling = queuedStalling.pindex;
+                    LogPrint("net", "Re-requesting block %s from peer=%d, stalled by peer=%d\n", hashStalling.ToString(), pto->id, staller);
+                    stateStaller->window.nBlocksInFlightMax = std::max(stateStaller->window.nBlocksInFlightMax / 2, MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+                    stateStaller->nStallingSince = 0;
+                    vGetData.push_back(CInv(MSG_BLOCK, hashStalling));
+                    MarkBlockAsInFlight(pto->GetId(), hashStalling, pindexStalling);
+                    staller = -1;
+                }
+            }
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
@@ -5513,9 +6026,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: getdata (non-blocks)
         //
+        // cs_main is already held here, so the side lane can only be tried
+        TRY_LOCK(cs_sideLane, lockSide);
         while (!pto->fDisconnect && !pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
         {
             const CInv& inv = (*pto->mapAskFor.begin()).second;
+            if (IsSideLaneInv(inv) && !lockSide)
+                break;
             if (!AlreadyHave(inv))
             {
                 if (fDebug)
@@ -5611,5 +6128,7 @@ public:
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapOrphanTransactionsByPeer.clear();
+        setOrphanTransactionsByExpiry.clear();
     }
 } instance_of_cmaincleanup;
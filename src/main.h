@@ -67,6 +67,12 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Largest orphan transaction we keep, in bytes */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Memory the orphans received from a single peer may use, in bytes */
+static const unsigned int MAX_ORPHAN_TX_PEER_BYTES = 20 * MAX_ORPHAN_TX_SIZE;
+/** Time after which an orphan whose parents never arrived is dropped, in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -81,8 +87,12 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
-static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Number of blocks that can be requested at any given time from a single peer we know nothing about yet.
+ *  The window of each peer then adapts between MIN_ and MAX_BLOCKS_IN_TRANSIT_PER_PEER to its delivery speed. */
+static const int DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the per-peer adaptive block download window. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 64;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -193,11 +203,16 @@ bool ProcessMessages(CNode* pfrom);
  * Send queued protocol messages to be sent to a give node.
  *
  * @param[in]   pto             The node which we are sending messages to.
- * @param[in]   fSendTrickle    When true send the trickled data, otherwise trickle the data until true.
+ * @param[in]   fSendTrickle    When true send the trickled addr data, otherwise trickle the data until true.
+ *                              Transaction inventory is batched on its own per-peer timer.
  */
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread doing context-free checks on relayed transactions */
+void ThreadTxPreCheck();
+/** Drop transactions still queued for or returned by the pre-check workers, once they have stopped */
+void StopTxPreCheck();
 
 /**
  * Check proof-of-work of a block header, taking auxpow into account.
@@ -239,7 +254,7 @@ void FlushStateToDisk();
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee=false, bool ignoreFees=false);
+                        bool* pfMissingInputs, bool fRejectInsaneFee=false, bool ignoreFees=false, bool fPreChecked=false);
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectInsaneFee=false, bool isDSTX=false);
@@ -248,11 +263,44 @@ int GetInputAge(CTxIn& vin);
 int GetInputAgeIX(uint256 nTXHash, CTxIn& vin);
 int GetIXConfirmations(uint256 nTXHash);
 
+/** How many blocks we are willing to have in flight from a peer, adapted to how fast it delivers them. */
+struct CBlockDownloadWindow {
+    //! Number of blocks we are willing to have in flight from this peer.
+    int nBlocksInFlightMax;
+    //! Smoothed time between requesting a block from this peer and receiving it (in microseconds), or 0 if unknown.
+    int64_t nBlockLatency;
+    //! Smoothed block download throughput from this peer (in bytes per second), or 0 if unknown.
+    int64_t nBlockThroughput;
+    //! When the last block requested from this peer arrived (in microseconds), or 0.
+    int64_t nLastBlockReceived;
+
+    CBlockDownloadWindow() {
+        nBlocksInFlightMax = DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlockLatency = 0;
+        nBlockThroughput = 0;
+        nLastBlockReceived = 0;
+    }
+
+    /** Fold a block of nSize bytes, requested at nRequested and received at nNow, into the latency and
+     *  throughput estimates. The window grows by one while deliveries keep pace and shrinks by one when
+     *  the latency jumps (the peer's queue is building up). */
+    void BlockReceived(int64_t nRequested, int64_t nNow, unsigned int nSize);
+};
+
+/** Whether a block requested at nRequested from a peer with window windowStaller, which holds back the
+ *  download window, should be asked from a peer with window window and nBlocksInFlight blocks in flight
+ *  instead. Only peers with room in their window and a measured latency qualify, and only once the block is
+ *  overdue compared to how quickly either peer normally delivers. */
+bool ShouldRerequestBlock(const CBlockDownloadWindow& window, int nBlocksInFlight, const CBlockDownloadWindow& windowStaller, int64_t nRequested, int64_t nNow);
+
 struct CNodeStateStats {
     int nMisbehavior;
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInFlightMax;
+    int64_t nBlockLatency;
+    int64_t nBlockThroughput;
 };
 
 struct CDiskTxPos : public CDiskBlockPos
@@ -322,10 +370,12 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. ptxdata, if given, holds the transaction's shared
+ * signature hash data and must outlive any checks pushed onto pvChecks.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL,
+                 const PrecomputedTransactionData *ptxdata = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight);
@@ -333,11 +383,15 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 /** Context-independent validity checks */
 bool CheckTransaction(const CTransaction& tx, CValidationState& state);
 
-/** Check for standard transaction types
+/** Check for standard transaction types. Does not depend on the chain state,
+ * finality against the next block is checked by AcceptToMemoryPool.
  * @return True if all outputs (scriptPubKeys) use only standard transaction forms
  */
 bool IsStandardTx(const CTransaction& tx, std::string& reason);
 
+/** The checks AcceptToMemoryPool runs before it needs cs_main: CheckTransaction, no coinbase and IsStandardTx */
+bool PreCheckTransaction(const CTransaction& tx, CValidationState& state);
+
 bool IsFinalTx(const CTransaction &tx, int nBlockHeight = 0, int64_t nBlockTime = 0);
 
 /** Undo information for a CBlock */
@@ -371,12 +425,13 @@ private:
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error;
+    const PrecomputedTransactionData *txdata;
 
 public:
-    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(NULL) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, const PrecomputedTransactionData* txdataIn = NULL) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
 
@@ -387,6 +442,7 @@ public:
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
+        std::swap(txdata, check.txdata);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -5,6 +5,8 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "prevector.h"
+
 #include <stdlib.h>
 
 #include <map>
@@ -45,6 +47,7 @@ template<typename X, typename Y> static inline size_t DynamicUsage(std::pair<X,
  *  updating on modification.
  */
 template<typename X> static size_t DynamicUsage(const std::vector<X>& v);
+template<unsigned int N, typename X, typename S, typename D> static size_t DynamicUsage(const prevector<N, X, S, D>& v);
 template<typename X> static size_t DynamicUsage(const std::set<X>& s);
 template<typename X, typename Y> static size_t DynamicUsage(const std::map<X, Y>& m);
 template<typename X, typename Y> static size_t DynamicUsage(const boost::unordered_set<X, Y>& s);
@@ -88,6 +91,13 @@ static inline size_t DynamicUsage(const std::vector<X>& v)
     return MallocUsage(v.capacity() * sizeof(X));
 }
 
+template<unsigned int N, typename X, typename S, typename D>
+static inline size_t DynamicUsage(const prevector<N, X, S, D>& v)
+{
+    // Inline storage is part of the object itself
+    return v.allocated_memory() ? MallocUsage(v.allocated_memory()) : 0;
+}
+
 template<typename X>
 static inline size_t RecursiveDynamicUsage(const std::vector<X>& v)
 {
@@ -18,10 +18,17 @@
 #include "darksend.h"
 #include "wallet.h"
 
+#include <math.h>
+
 #ifdef WIN32
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -33,6 +40,7 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
+#include <zlib.h>
 
 // Dump addresses to peers.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
@@ -57,6 +65,16 @@ using namespace std;
 
 namespace {
     const int MAX_OUTBOUND_CONNECTIONS = 12;
+#ifndef WIN32
+    // Messages gathered into a single sendmsg() call, well below any IOV_MAX
+    const int MAX_SEND_IOV = 64;
+#endif
+#ifdef USE_EPOLL
+    const int MAX_EPOLL_EVENTS = 256;
+
+    /** Edge-triggered epoll set watched by the socket handler thread. */
+    int hEpollSocket = -1;
+#endif
 
     struct ListenSocket {
         SOCKET socket;
@@ -85,9 +103,10 @@ bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSerializeDataRef> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
+static size_t nRelayMemory = 0;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
 static deque<string> vOneShots;
@@ -103,7 +122,16 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
+static int nMaxOutbound = MAX_OUTBOUND_CONNECTIONS;
 boost::condition_variable messageHandlerCondition;
+CUploadLimiter uploadLimiter;
+
+static std::map<CInv, CSerializeDataRef> mapMessageCache;
+static std::deque<CInv> vMessageCacheOrder;
+static size_t nMessageCacheSize = 0;
+static CCriticalSection cs_mapMessageCache;
+// Shared by all message handler threads waiting on messageHandlerCondition
+static boost::mutex messageHandlerMutex;
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -388,6 +416,31 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+static CNode* AddOutboundNode(SOCKET hSocket, const CAddress& addrConnect, const char *pszDest, bool darkSendMaster)
+{
+    if (!IsSelectableSocket(hSocket)) {
+        LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
+        CloseSocket(hSocket);
+        return NULL;
+    }
+
+    addrman.Attempt(addrConnect);
+
+    // Add node
+    CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
+    pnode->AddRef();
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(pnode);
+    }
+
+    pnode->nTimeConnected = GetTime();
+    if(darkSendMaster) pnode->fDarkSendMaster = true;
+
+    return pnode;
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool darkSendMaster)
 {
     if (pszDest == NULL) {
@@ -418,27 +471,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool darkSendMaste
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
-            LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
-            CloseSocket(hSocket);
-            return NULL;
-        }
-
-        addrman.Attempt(addrConnect);
-
-        // Add node
-        CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
-        pnode->AddRef();
-
-        {
-            LOCK(cs_vNodes);
-            vNodes.push_back(pnode);
-        }
-
-        pnode->nTimeConnected = GetTime();
-        if(darkSendMaster) pnode->fDarkSendMaster = true;
-
-        return pnode;
+        return AddOutboundNode(hSocket, addrConnect, pszDest, darkSendMaster);
     } else if (!proxyConnectionFailed) {
         // If connecting to the node failed, and failure is not caused by a problem connecting to
         // the proxy, mark this as an attempt.
@@ -448,12 +481,58 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool darkSendMaste
     return NULL;
 }
 
+std::vector<CNode*> ConnectNodes(const std::vector<CAddress>& vAddrConnect, unsigned int nMaxConnect, bool darkSendMaster)
+{
+    std::vector<CNode*> vNodesRet(vAddrConnect.size(), (CNode*)NULL);
+    std::vector<CService> vRace;
+    std::vector<size_t> vRaceIndex;
+    unsigned int nConnected = 0;
+
+    for (size_t i = 0; i < vAddrConnect.size() && nConnected < nMaxConnect; i++) {
+        const CAddress& addr = vAddrConnect[i];
+        if (IsLocal(addr) && !darkSendMaster)
+            continue;
+        // Existing connections and proxied addresses go through ConnectNode,
+        // which returns at once or has to run the proxy handshake anyway
+        proxyType proxy;
+        if (FindNode((CService)addr) || GetProxy(addr.GetNetwork(), proxy)) {
+            if ((vNodesRet[i] = ConnectNode(addr, NULL, darkSendMaster)))
+                nConnected++;
+            continue;
+        }
+        vRace.push_back(addr);
+        vRaceIndex.push_back(i);
+    }
+    if (nConnected >= nMaxConnect || vRace.empty())
+        return vNodesRet;
+
+    LogPrint("net", "racing connections to %u candidates for %u slots\n", vRace.size(), nMaxConnect - nConnected);
+    std::vector<SOCKET> vSocket;
+    std::vector<bool> vFailed;
+    size_t nTried = ConnectSocketsParallel(vRace, vSocket, vFailed, nMaxConnect - nConnected, nConnectTimeout, CONNECT_STAGGER_MS);
+    for (size_t j = 0; j < nTried; j++) {
+        const CAddress& addr = vAddrConnect[vRaceIndex[j]];
+        if (vSocket[j] != INVALID_SOCKET)
+            vNodesRet[vRaceIndex[j]] = AddOutboundNode(vSocket[j], addr, NULL, darkSendMaster);
+        else if (vFailed[j])
+            addrman.Attempt(addr);
+    }
+
+    return vNodesRet;
+}
+
 void CNode::CloseSocketDisconnect()
 {
     fDisconnect = true;
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint("net", "disconnecting peer=%d\n", id);
+#ifdef USE_EPOLL
+        // Deregister explicitly: a forked child may still hold the socket
+        // open, which would keep it in the epoll set after close()
+        if (hEpollSocket != -1)
+            epoll_ctl(hEpollSocket, EPOLL_CTL_DEL, hSocket, NULL);
+#endif
         CloseSocket(hSocket);
     }
 
@@ -552,6 +631,11 @@ void CNode::copyStats(CNodeStats &stats)
     X(nStartingHeight);
     X(nSendBytes);
     X(nRecvBytes);
+    {
+        LOCK(cs_mapMsgCmdCount);
+        X(mapSendPerMsgCmd);
+        X(mapRecvPerMsgCmd);
+    }
     X(fWhitelisted);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -606,6 +690,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
+            RecordMessage(mapRecvPerMsgCmd, msg.hdr.GetCommand(), CMessageHeader::HEADER_SIZE + msg.hdr.nMessageSize);
             messageHandlerCondition.notify_one();
         }
     }
@@ -613,21 +698,85 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
     return true;
 }
 
+/**
+ * Receive buffers are recycled through a few size classes, so that the
+ * steady stream of small inv, mnp and txlvote messages doesn't allocate and
+ * free a buffer each. Larger messages grow their own buffer as before.
+ */
+static const size_t RECV_BUFFER_CLASS_SIZE[] = { 1024, 16 * 1024, 256 * 1024 };
+static const size_t RECV_BUFFER_CLASS_DEPTH[] = { 256, 64, 8 };
+static const unsigned int RECV_BUFFER_CLASSES = ARRAYLEN(RECV_BUFFER_CLASS_SIZE);
+static std::vector<CSerializeData> vRecvBufferPool[RECV_BUFFER_CLASSES];
+static CCriticalSection cs_vRecvBufferPool;
+
+static void AcquireRecvBuffer(CDataStream& vRecv, unsigned int nSize)
+{
+    for (unsigned int i = 0; i < RECV_BUFFER_CLASSES; i++) {
+        if (nSize > RECV_BUFFER_CLASS_SIZE[i])
+            continue;
+        CSerializeData data;
+        {
+            LOCK(cs_vRecvBufferPool);
+            if (!vRecvBufferPool[i].empty()) {
+                data.swap(vRecvBufferPool[i].back());
+                vRecvBufferPool[i].pop_back();
+            }
+        }
+        if (data.capacity() < RECV_BUFFER_CLASS_SIZE[i])
+            data.reserve(RECV_BUFFER_CLASS_SIZE[i]);
+        vRecv.swap(data);
+        return;
+    }
+}
+
+static void ReleaseRecvBuffer(CSerializeData& data)
+{
+    for (int i = RECV_BUFFER_CLASSES - 1; i >= 0; i--) {
+        if (data.capacity() < RECV_BUFFER_CLASS_SIZE[i])
+            continue;
+        // Buffers that grew past the largest class are not kept
+        if (i == (int)RECV_BUFFER_CLASSES - 1 && data.capacity() > RECV_BUFFER_CLASS_SIZE[i])
+            return;
+        data.clear();
+        LOCK(cs_vRecvBufferPool);
+        if (vRecvBufferPool[i].size() < RECV_BUFFER_CLASS_DEPTH[i]) {
+            vRecvBufferPool[i].push_back(CSerializeData());
+            vRecvBufferPool[i].back().swap(data);
+        }
+        return;
+    }
+}
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData data;
+    vRecv.swap(data);
+    ReleaseRecvBuffer(data);
+}
+
+uint256 CNetMessage::GetMessageHash() const
+{
+    uint256 hash;
+    CHash256(hasher).Finalize(hash.begin());
+    return hash;
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    memcpy(&hdrbuf[nHdrPos], pch, nCopy);
+    memcpy(&pchHdrBuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
     try {
+        CDataStream hdrbuf(pchHdrBuf, pchHdrBuf + CMessageHeader::HEADER_SIZE, vRecv.nType, vRecv.nVersion);
         hdrbuf >> hdr;
     }
     catch (const std::exception &) {
@@ -640,6 +789,8 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 
     // switch state to reading message data
     in_data = true;
+    if (hdr.nMessageSize > 0)
+        AcquireRecvBuffer(vRecv, hdr.nMessageSize);
 
     return nCopy;
 }
@@ -651,10 +802,12 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
+        // Pooled buffers already have the capacity for the whole message.
         vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
     }
 
     memcpy(&vRecv[nDataPos], pch, nCopy);
+    hasher.Write((const unsigned char*)pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -671,23 +824,54 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSerializeDataRef>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert((*it)->size() > pnode->nSendOffset);
+#ifdef WIN32
+        const CSerializeData &data = **it;
+        size_t nRequested = data.size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nRequested, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Hand the kernel as many queued messages as one sendmsg() takes
+        struct iovec iov[MAX_SEND_IOV];
+        size_t nRequested = 0;
+        int nIov = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (std::deque<CSerializeDataRef>::iterator itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; itIov++) {
+            const CSerializeData &data = **itIov;
+            iov[nIov].iov_base = (void*)&data[nOffset];
+            iov[nIov].iov_len = data.size() - nOffset;
+            nRequested += iov[nIov].iov_len;
+            nOffset = 0;
+            nIov++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            uploadLimiter.Consume(nBytes, GetTimeMicros());
+            // Retire the messages that went out completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nRequested) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -717,6 +901,11 @@ static list<CNode*> vNodesDisconnected;
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    // Carried over from the previous round to pick the epoll_wait timeout
+    bool fMoreWork = false;
+    bool fRecvDeferred = false;
+#endif
     while (true)
     {
         //
@@ -785,6 +974,52 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
+        set<SOCKET> setListenReady;
+
+#ifdef USE_EPOLL
+        // Node sockets are registered edge-triggered when their CNode is
+        // created, so there is nothing to rebuild here. Don't block if the
+        // previous round left work that can be done right away, and keep
+        // polling at the old select() rate while reads are held back.
+        int nTimeout = fMoreWork ? 0 : (fRecvDeferred ? 50 : 1000);
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int nEvents = epoll_wait(hEpollSocket, events, MAX_EPOLL_EVENTS, nTimeout);
+        boost::this_thread::interruption_point();
+
+        if (nEvents < 0)
+        {
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR)
+            {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+                MilliSleep(50);
+            }
+            nEvents = 0;
+        }
+
+        fMoreWork = false;
+        fRecvDeferred = false;
+
+        bool fListenEvent = false;
+        for (int i = 0; i < nEvents; i++)
+        {
+            CNode* pnode = (CNode*)events[i].data.ptr;
+            if (pnode == NULL)
+            {
+                fListenEvent = true;
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                pnode->fPollRecv = true;
+            if (events[i].events & EPOLLOUT)
+                pnode->fPollSend = true;
+        }
+        if (fListenEvent)
+        {
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+                setListenReady.insert(hListenSocket.socket);
+        }
+#else
         struct timeval timeout;
         timeout.tv_sec  = 0;
         timeout.tv_usec = 50000; // frequency to poll pnode->vSend
@@ -864,12 +1099,28 @@ void ThreadSocketHandler()
             MilliSleep(timeout.tv_usec/1000);
         }
 
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+                setListenReady.insert(hListenSocket.socket);
+
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
+            {
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                pnode->fPollRecv = FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError);
+                pnode->fPollSend = FD_ISSET(pnode->hSocket, &fdsetSend);
+            }
+        }
+#endif
+
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && setListenReady.count(hListenSocket.socket))
             {
                 struct sockaddr_storage sockaddr;
                 socklen_t len = sizeof(sockaddr);
@@ -952,7 +1203,29 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            bool fRecvReady = pnode->fPollRecv;
+#ifdef USE_EPOLL
+            // Same policy the select() path encodes in its fd sets: drain
+            // pending sends first and leave a full receive buffer to the
+            // message handler. The socket stays marked readable meanwhile.
+            if (fRecvReady)
+            {
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend && !pnode->vSendMsg.empty())
+                        fRecvReady = false;
+                }
+                {
+                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                    if (lockRecv && !pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+                        pnode->GetTotalRecvSize() > ReceiveFloodSize())
+                        fRecvReady = false;
+                }
+                if (!fRecvReady)
+                    fRecvDeferred = true;
+            }
+#endif
+            if (fRecvReady)
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -963,6 +1236,13 @@ void ThreadSocketHandler()
                         int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
                         if (nBytes > 0)
                         {
+                            // A short read means the socket has been drained
+                            if (nBytes < (int)sizeof(pchBuf))
+                                pnode->fPollRecv = false;
+#ifdef USE_EPOLL
+                            else
+                                fMoreWork = true;
+#endif
                             if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
                                 pnode->CloseSocketDisconnect();
                             pnode->nLastRecv = GetTime();
@@ -980,7 +1260,9 @@ void ThreadSocketHandler()
                         {
                             // error
                             int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                            if (nErr == WSAEWOULDBLOCK)
+                                pnode->fPollRecv = false;
+                            else if (nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                             {
                                 if (!pnode->fDisconnect)
                                     LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
@@ -989,6 +1271,10 @@ void ThreadSocketHandler()
                         }
                     }
                 }
+#ifdef USE_EPOLL
+                else
+                    fMoreWork = true;
+#endif
             }
 
             //
@@ -996,11 +1282,23 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (pnode->fPollSend)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
-                    SocketSendData(pnode);
+                {
+                    if (!pnode->vSendMsg.empty())
+                    {
+                        SocketSendData(pnode);
+                        // Wait for the socket to report writable again
+                        if (!pnode->vSendMsg.empty())
+                            pnode->fPollSend = false;
+                    }
+                }
+#ifdef USE_EPOLL
+                else
+                    fMoreWork = true;
+#endif
             }
 
             //
@@ -1230,6 +1528,41 @@ void DumpAddresses()
            addrman.size(), GetTimeMillis() - nStart);
 }
 
+// moves the passed grant to the first node connected, and takes further
+// outbound slots for the others while they are free
+static void OpenNetworkConnections(const std::vector<CAddress>& vAddrConnect, CSemaphoreGrant& grantOutbound, unsigned int nMaxConnect)
+{
+    boost::this_thread::interruption_point();
+    std::vector<CAddress> vCandidates;
+    BOOST_FOREACH(const CAddress& addr, vAddrConnect) {
+        if (IsLocal(addr) ||
+            FindNode((CNetAddr)addr) || CNode::IsBanned(addr) ||
+            FindNode(addr.ToStringIPPort()))
+            continue;
+        vCandidates.push_back(addr);
+    }
+
+    std::vector<CNode*> vNodesNew = ConnectNodes(vCandidates, nMaxConnect);
+    boost::this_thread::interruption_point();
+
+    bool fGrantUsed = false;
+    BOOST_FOREACH(CNode* pnode, vNodesNew) {
+        if (!pnode)
+            continue;
+        pnode->fNetworkNode = true;
+        if (!fGrantUsed) {
+            grantOutbound.MoveTo(pnode->grantOutbound);
+            fGrantUsed = true;
+            continue;
+        }
+        CSemaphoreGrant grant(*semOutbound, true);
+        if (grant)
+            grant.MoveTo(pnode->grantOutbound);
+        else
+            pnode->fDisconnect = true; // the slots filled up meanwhile
+    }
+}
+
 void static ProcessOneShot()
 {
     string strDest;
@@ -1291,9 +1624,9 @@ void ThreadOpenConnections()
         }
 
         //
-        // Choose an address to connect to based on most recently seen
+        // Choose addresses to connect to based on most recently seen
         //
-        CAddress addrConnect;
+        std::vector<CAddress> vAddrConnect;
 
         // Only connect out to one peer per network group (/16 for IPv4).
         // Do this here so we don't have to critsect vNodes inside mapAddresses critsect.
@@ -1311,8 +1644,10 @@ void ThreadOpenConnections()
 
         int64_t nANow = GetAdjustedTime();
 
+        // Race candidates for as many free outbound slots as there are
+        unsigned int nSlots = std::max(1, std::min(nMaxOutbound - nOutbound, (int)MAX_PARALLEL_CONNECTS));
         int nTries = 0;
-        while (true)
+        while (vAddrConnect.size() < nSlots)
         {
             CAddress addr = addrman.Select();
 
@@ -1338,12 +1673,13 @@ void ThreadOpenConnections()
             if (addr.GetPort() != Params().GetDefaultPort() && nTries < 50)
                 continue;
 
-            addrConnect = addr;
-            break;
+            // one candidate per network group, as with established connections
+            setConnected.insert(addr.GetGroup());
+            vAddrConnect.push_back(addr);
         }
 
-        if (addrConnect.IsValid())
-            OpenNetworkConnection(addrConnect, &grant);
+        if (!vAddrConnect.empty())
+            OpenNetworkConnections(vAddrConnect, grant, vAddrConnect.size());
     }
 }
 
@@ -1411,8 +1747,12 @@ void ThreadOpenAddedConnections()
         }
         BOOST_FOREACH(vector<CService>& vserv, lservAddressesToAdd)
         {
+            // Race all addresses of the entry, starting with a different one each round
+            vector<CAddress> vAddrConnect;
+            for (unsigned int j = 0; j < vserv.size(); j++)
+                vAddrConnect.push_back(CAddress(vserv[(i + j) % vserv.size()]));
             CSemaphoreGrant grant(*semOutbound);
-            OpenNetworkConnection(CAddress(vserv[i % vserv.size()]), &grant);
+            OpenNetworkConnections(vAddrConnect, grant, 1);
             MilliSleep(500);
         }
         MilliSleep(120000); // Retry every 2 minutes
@@ -1451,9 +1791,6 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 
 void ThreadMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
-    
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true)
     {
@@ -1473,8 +1810,14 @@ void ThreadMessageHandler()
 
         bool fSleep = true;
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        // Start at a random peer so that concurrent handler threads spread
+        // out over the node list. A peer whose cs_vRecvMsg is already held is
+        // being serviced by another thread and is skipped, which keeps each
+        // peer's messages strictly ordered.
+        size_t nStart = vNodesCopy.empty() ? 0 : GetRand(vNodesCopy.size());
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[(nStart + i) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
@@ -1486,9 +1829,10 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize())
+                    if (pnode->nSendSize < SendBufferSize() && !pnode->fRecvLaneBusy)
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if ((!pnode->vRecvGetData.empty() && !pnode->fUploadThrottled) ||
+                            (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
                             fSleep = false;
                         }
@@ -1499,8 +1843,10 @@ void ThreadMessageHandler()
 
             // Send messages
             {
+                // Holding cs_vRecvMsg too keeps other handler threads off this peer
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockRecv && lockSend)
                     g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
             }
             boost::this_thread::interruption_point();
@@ -1514,7 +1860,10 @@ void ThreadMessageHandler()
         }
 
         if (fSleep)
+        {
+            boost::unique_lock<boost::mutex> lock(messageHandlerMutex);
             messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        }
     }
 }
 
@@ -1688,13 +2037,31 @@ void StartNode(boost::thread_group& threadGroup)
 
     if (semOutbound == NULL) {
         // initialize semaphore
-        int nMaxOutbound = min(MAX_OUTBOUND_CONNECTIONS, nMaxConnections);
+        nMaxOutbound = min(MAX_OUTBOUND_CONNECTIONS, nMaxConnections);
         semOutbound = new CSemaphore(nMaxOutbound);
     }
 
     if (pnodeLocalHost == NULL)
         pnodeLocalHost = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0), nLocalServices));
 
+#ifdef USE_EPOLL
+    if (hEpollSocket == -1)
+    {
+        hEpollSocket = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpollSocket == -1)
+            throw std::runtime_error(strprintf("epoll_create1 failed: %s", NetworkErrorString(WSAGetLastError())));
+    }
+    // Listen sockets stay level-triggered; accept() takes one connection per round
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if (epoll_ctl(hEpollSocket, EPOLL_CTL_ADD, hListenSocket.socket, &event) == -1)
+            LogPrintf("epoll_ctl failed for listen socket: %s\n", NetworkErrorString(WSAGetLastError()));
+    }
+#endif
+
     Discover(threadGroup);
 
     //
@@ -1718,8 +2085,13 @@ void StartNode(boost::thread_group& threadGroup)
     // Initiate outbound connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
+    uploadLimiter.SetRate(1000 * GetArg("-maxuploadrate", 0), GetTimeMicros());
+
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    int nMessageHandlerThreads = GetArg("-msghandlerthreads", DEFAULT_MSGHANDLER_THREADS);
+    nMessageHandlerThreads = std::max(1, std::min(nMessageHandlerThreads, MAX_MSGHANDLER_THREADS));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
     // Dump network addresses
     threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "dumpaddr", &DumpAddresses, DUMP_ADDRESSES_INTERVAL * 1000));
@@ -1772,6 +2144,14 @@ public:
         delete pnodeLocalHost;
         pnodeLocalHost = NULL;
 
+#ifdef USE_EPOLL
+        if (hEpollSocket != -1)
+        {
+            close(hEpollSocket);
+            hEpollSocket = -1;
+        }
+#endif
+
 #ifdef WIN32
         // Shutdown Windows Sockets
         WSACleanup();
@@ -1788,30 +2168,41 @@ void CExplicitNetCleanup::callCleanup()
     delete tmp; // Stroustrup's gonna kill me for that
 }
 
+/**
+ * Keep a relayed message for peers asking for it. The buffer is shared with
+ * the send queues it was pushed to. Entries leave in insertion order, when
+ * they expire or when the map exceeds its memory budget.
+ */
+static void AddRelayMessage(const CInv& inv, const CSerializeDataRef& msg)
+{
+    LOCK(cs_mapRelay);
+    int64_t nNow = GetTime();
+    while (!vRelayExpiration.empty() &&
+           (vRelayExpiration.front().first < nNow || nRelayMemory + msg->size() > MAX_RELAY_MEMORY))
+    {
+        std::map<CInv, CSerializeDataRef>::iterator it = mapRelay.find(vRelayExpiration.front().second);
+        nRelayMemory -= it->second->size();
+        mapRelay.erase(it);
+        vRelayExpiration.pop_front();
+    }
+
+    // Keep the original serialized message so newer versions are preserved
+    if (msg->size() <= MAX_RELAY_MEMORY && mapRelay.insert(std::make_pair(inv, msg)).second) {
+        nRelayMemory += msg->size();
+        vRelayExpiration.push_back(std::make_pair(nNow + RELAY_EXPIRY, inv));
+    }
+}
+
 void RelayTransaction(const CTransaction& tx)
 {
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
-    ss << tx;
-    RelayTransaction(tx, ss);
+    RelayTransaction(tx, CNode::MakeMessage("tx", tx));
 }
 
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
+void RelayTransaction(const CTransaction& tx, const CSerializeDataRef& msg)
 {
     CInv inv(MSG_TX, tx.GetHash());
-    {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
-        {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
+    AddRelayMessage(inv, msg);
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
-    }
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
     {
@@ -1831,6 +2222,10 @@ void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
 {
     CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
 
+    // Serialize the lock request once, for every peer and for getdata
+    CSerializeDataRef msg = CNode::MakeMessage("ix", tx);
+    AddRelayMessage(inv, msg);
+
     //broadcast the new lock
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
@@ -1838,8 +2233,74 @@ void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
         if(!relayToAll && !pnode->fRelayTxes)
             continue;
 
-        pnode->PushMessage("ix", tx);
+        pnode->PushSharedMessage("ix", msg);
+    }
+}
+
+bool CMessageBatch::IsBatchable(const std::string& strCommand)
+{
+    static const char* const pszBatchCommands[] = {
+        "mnb", "mnp", "mnw", "mprop", "mvote", "fbs", "fbvote", "spork", "ix", "txlvote"
+    };
+    for (unsigned int i = 0; i < ARRAYLEN(pszBatchCommands); i++)
+        if (strCommand == pszBatchCommands[i])
+            return true;
+    return false;
+}
+
+void CMessageBatch::Flush()
+{
+    if (nMessages == 0)
+        return;
+    CDataStream ssEnvelope(SER_NETWORK, PROTOCOL_VERSION);
+    std::vector<unsigned char> vDeflated(compressBound(ssBatch.size()));
+    uLongf nDeflated = vDeflated.size();
+    if (ssBatch.size() <= MAX_BATCH_INFLATED_SIZE &&
+        compress2(&vDeflated[0], &nDeflated, (const Bytef*)&ssBatch[0], ssBatch.size(), Z_BEST_SPEED) == Z_OK &&
+        nDeflated < ssBatch.size()) {
+        ssEnvelope << (unsigned char)BATCH_ZLIB;
+        ssEnvelope.write((const char*)&vDeflated[0], nDeflated);
+    } else {
+        ssEnvelope << (unsigned char)BATCH_PLAIN << ssBatch;
+    }
+    pnode->PushMessage("batch", ssEnvelope);
+    ssBatch.clear();
+    nMessages = 0;
+}
+
+bool CMessageBatch::Unpack(CDataStream& vRecv, CDataStream& ssEntries)
+{
+    unsigned char nFormat;
+    vRecv >> nFormat;
+    if (nFormat == BATCH_PLAIN) {
+        if (!vRecv.empty())
+            ssEntries.write(&vRecv[0], vRecv.size());
+        vRecv.clear();
+        return true;
     }
+    if (nFormat != BATCH_ZLIB || vRecv.empty())
+        return false;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+    stream.next_in = (Bytef*)&vRecv[0];
+    stream.avail_in = vRecv.size();
+    char buf[16 * 1024];
+    int ret;
+    do {
+        stream.next_out = (Bytef*)buf;
+        stream.avail_out = sizeof(buf);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+        ssEntries.write(buf, sizeof(buf) - stream.avail_out);
+    } while (ret == Z_OK && ssEntries.size() <= MAX_BATCH_INFLATED_SIZE);
+    bool fComplete = ret == Z_STREAM_END && stream.avail_in == 0 && ssEntries.size() <= MAX_BATCH_INFLATED_SIZE;
+    inflateEnd(&stream);
+    vRecv.clear();
+    return fComplete;
 }
 
 void RelayInv(CInv &inv, const int minProtoVersion) {
@@ -1849,6 +2310,113 @@ void RelayInv(CInv &inv, const int minProtoVersion) {
             pnode->PushInventory(inv);
 }
 
+CSerializeDataRef GetCachedMessage(const CInv& inv)
+{
+    LOCK(cs_mapMessageCache);
+    std::map<CInv, CSerializeDataRef>::const_iterator it = mapMessageCache.find(inv);
+    if (it == mapMessageCache.end())
+        return CSerializeDataRef();
+    return it->second;
+}
+
+void CacheMessage(const CInv& inv, const CSerializeDataRef& msg)
+{
+    if (msg->size() > MAX_MESSAGE_CACHE_SIZE)
+        return;
+
+    LOCK(cs_mapMessageCache);
+    if (!mapMessageCache.insert(std::make_pair(inv, msg)).second)
+        return;
+    vMessageCacheOrder.push_back(inv);
+    nMessageCacheSize += msg->size();
+
+    // Evict the oldest entries; peers still sending them keep their reference
+    while (nMessageCacheSize > MAX_MESSAGE_CACHE_SIZE) {
+        std::map<CInv, CSerializeDataRef>::iterator it = mapMessageCache.find(vMessageCacheOrder.front());
+        nMessageCacheSize -= it->second->size();
+        mapMessageCache.erase(it);
+        vMessageCacheOrder.pop_front();
+    }
+}
+
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
+CUploadLimiter::CUploadLimiter()
+{
+    nRate = 0;
+    nBurst = 0;
+    nTokens = 0;
+    nLastRefill = 0;
+}
+
+void CUploadLimiter::Refill(int64_t nNow)
+{
+    // Two bursts of time fill the bucket from any level
+    int64_t nElapsed = std::min(nNow - nLastRefill, (int64_t)2 * UPLOAD_BURST_SECONDS * 1000000);
+    int64_t nNew = nElapsed * nRate / 1000000;
+    if (nTokens + nNew >= nBurst) {
+        nTokens = nBurst;
+        nLastRefill = nNow;
+    } else if (nNew > 0) {
+        // Only account for the time of whole tokens, so that frequent calls don't round the rate down
+        nTokens += nNew;
+        nLastRefill += nNew * 1000000 / nRate;
+    }
+}
+
+void CUploadLimiter::SetRate(int64_t nRateIn, int64_t nNow)
+{
+    LOCK(cs);
+    nRate = std::max<int64_t>(nRateIn, 0);
+    nBurst = nRate * UPLOAD_BURST_SECONDS;
+    nTokens = nBurst;
+    nLastRefill = nNow;
+}
+
+bool CUploadLimiter::IsLimited()
+{
+    LOCK(cs);
+    return nRate > 0;
+}
+
+bool CUploadLimiter::Allow(UploadClass nClass, int64_t nNow)
+{
+    LOCK(cs);
+    if (nRate == 0 || nClass == UPLOAD_BLOCK_RELAY)
+        return true;
+    Refill(nNow);
+    if (nClass == UPLOAD_HISTORICAL_BLOCK)
+        return nTokens >= nBurst / 4;
+    return nTokens >= nBurst / 2;
+}
+
+void CUploadLimiter::Consume(uint64_t nBytes, int64_t nNow)
+{
+    LOCK(cs);
+    if (nRate == 0)
+        return;
+    Refill(nNow);
+    nTokens = std::max(-nBurst, nTokens - (int64_t)nBytes);
+}
+
+void CNode::RecordMessage(mapMsgCmdCount& mapPerMsgCmd, const std::string& strCommand, uint64_t nBytes)
+{
+    LOCK(cs_mapMsgCmdCount);
+    mapMsgCmdCount::iterator it = mapPerMsgCmd.find(strCommand);
+    if (it == mapPerMsgCmd.end()) {
+        // Don't let a peer grow the map with made up commands
+        if (mapPerMsgCmd.size() >= MAX_MSG_CMD_COUNTS)
+            it = mapPerMsgCmd.insert(std::make_pair("*other*", CMsgCmdCount())).first;
+        else
+            it = mapPerMsgCmd.insert(std::make_pair(strCommand, CMsgCmdCount())).first;
+    }
+    it->second.nMessages++;
+    it->second.nBytes += nBytes;
+}
+
 void CNode::RecordBytesRecv(uint64_t bytes)
 {
     LOCK(cs_totalBytesRecv);
@@ -2008,11 +2576,18 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
-CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) :
+    ssSend(SER_NETWORK, INIT_PROTO_VERSION),
+    filterAddrKnown(ADDR_KNOWN_MAX, 0.001, insecure_rand()),
+    filterInventoryKnown(INVENTORY_KNOWN_MAX, 0.000001, insecure_rand())
 {
     nServices = 0;
     hSocket = hSocketIn;
     nRecvVersion = INIT_PROTO_VERSION;
+    fRecvLaneBusy = false;
+    fUploadThrottled = false;
+    fPollRecv = false;
+    fPollSend = false;
     nLastSend = 0;
     nLastRecv = 0;
     nSendBytes = 0;
@@ -2036,7 +2611,7 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
-    setInventoryKnown.max_size(SendBufferSize() / 1000);
+    nNextInvSend = 0;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2054,6 +2629,17 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     else
         LogPrint("net", "Added connection peer=%d\n", id);
 
+#ifdef USE_EPOLL
+    if (hSocket != INVALID_SOCKET && hEpollSocket != -1)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = this;
+        if (epoll_ctl(hEpollSocket, EPOLL_CTL_ADD, hSocket, &event) == -1)
+            LogPrintf("epoll_ctl failed for peer=%d: %s\n", id, NetworkErrorString(WSAGetLastError()));
+    }
+#endif
+
     // Be shy and don't send version until we hear
     if (hSocket != INVALID_SOCKET && !fInbound)
         PushVersion();
@@ -2101,11 +2687,32 @@ void CNode::AskFor(const CInv& inv)
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
+void CNode::BeginMessageHeader(CDataStream& ss, const char* pszCommand)
+{
+    assert(ss.size() == 0);
+    ss << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+}
+
+unsigned int CNode::FinalizeMessageHeader(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    return nSize;
+}
+
 void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
-    assert(ssSend.size() == 0);
-    ssSend << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+    BeginMessageHeader(ssSend, pszCommand);
     LogPrint("net", "sending: %s ", SanitizeString(pszCommand));
 }
 
@@ -2135,26 +2742,42 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     if (ssSend.size() == 0)
         return;
 
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
-
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    unsigned int nSize = FinalizeMessageHeader(ssSend);
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    const char* pchCommand = &ssSend[MESSAGE_START_SIZE];
+    RecordMessage(mapSendPerMsgCmd, std::string(pchCommand, strnlen(pchCommand, CMessageHeader::COMMAND_SIZE)), ssSend.size());
+
+    boost::shared_ptr<CSerializeData> msg(new CSerializeData());
+    ssSend.GetAndClear(*msg);
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
+
+void CNode::PushSharedMessage(const char* pszCommand, const CSerializeDataRef& msg)
+{
+    LOCK(cs_vSend);
+    // -fuzzmessagestest is not applied, the buffer may be queued to other peers
+    if (mapArgs.count("-dropmessagestest") && GetRand(GetArg("-dropmessagestest", 2)) == 0)
+    {
+        LogPrint("net", "dropmessages DROPPING SEND MESSAGE\n");
+        return;
+    }
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", SanitizeString(pszCommand), msg->size() - CMessageHeader::HEADER_SIZE, id);
+
+    RecordMessage(mapSendPerMsgCmd, pszCommand, msg->size());
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+
+    // If write queue empty, attempt "optimistic write"
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
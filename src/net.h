@@ -10,7 +10,6 @@
 #include "compat.h"
 #include "hash.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -28,6 +27,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
@@ -56,12 +56,49 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
+/** Maximum number of outbound connection candidates raced at once. */
+static const unsigned int MAX_PARALLEL_CONNECTS = 8;
+/** Delay before the next raced connection candidate is tried, in milliseconds. */
+static const int CONNECT_STAGGER_MS = 250;
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** Number of recently announced/received inventory items remembered per peer. */
+static const unsigned int INVENTORY_KNOWN_MAX = 10000;
+/** Number of recently sent/received addresses remembered per peer. */
+static const unsigned int ADDR_KNOWN_MAX = 5000;
+/** Average delay between batched transaction inventory broadcasts in seconds.
+ *  Blocks and other non-transaction inventory, and whitelisted receivers, bypass this. */
+static const unsigned int AVG_INVENTORY_BROADCAST_INTERVAL = 5;
+/** Maximum number of transaction inventory items to send per batch.
+ *  Limits the impact of low-fee transaction floods. */
+static const unsigned int INVENTORY_BROADCAST_MAX = 7 * AVG_INVENTORY_BROADCAST_INTERVAL;
+/** Maximum total size of serialized block and transaction messages kept for reuse. */
+static const size_t MAX_MESSAGE_CACHE_SIZE = 8 * 1000 * 1000;
+/** Maximum total size of the relayed messages kept in mapRelay. */
+static const size_t MAX_RELAY_MEMORY = 10 * 1000 * 1000;
+/** Time in seconds relayed messages are kept in mapRelay. */
+static const int64_t RELAY_EXPIRY = 15 * 60;
+/** Maximum number of messages in one "batch" envelope. */
+static const unsigned int MAX_BATCH_MESSAGES = 1000;
+/** Size at which a "batch" envelope is sent without waiting for more messages. */
+static const unsigned int MAX_BATCH_SIZE = 256 * 1000;
+/** Largest a compressed "batch" envelope may inflate to: a full envelope plus the message that filled it. */
+static const unsigned int MAX_BATCH_INFLATED_SIZE = 2 * MAX_BATCH_SIZE;
+/** Default number of message handler threads. */
+static const int DEFAULT_MSGHANDLER_THREADS = 2;
+/** Maximum number of message handler threads. */
+static const int MAX_MSGHANDLER_THREADS = 16;
+/** Maximum number of distinct commands counted per peer, others are counted as "*other*". */
+static const unsigned int MAX_MSG_CMD_COUNTS = 64;
+/** Number of seconds of -maxuploadrate the upload limiter lets through in one burst. */
+static const int UPLOAD_BURST_SECONDS = 4;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
 
+/** A complete, immutable network message (header included) that may be queued to several peers */
+typedef boost::shared_ptr<const CSerializeData> CSerializeDataRef;
+
 void AddOneShot(std::string strDest);
 bool RecvLine(SOCKET hSocket, std::string& strLine);
 void AddressCurrentlyConnected(const CService& addr);
@@ -69,6 +106,8 @@ CNode* FindNode(const CNetAddr& ip);
 CNode* FindNode(const std::string& addrName);
 CNode* FindNode(const CService& ip);
 CNode* ConnectNode(CAddress addrConnect, const char *pszDest = NULL, bool darkSendMaster=false);
+/** Race connections to several candidates; returns the nodes of up to nMaxConnect winners by candidate index, NULL elsewhere */
+std::vector<CNode*> ConnectNodes(const std::vector<CAddress>& vAddrConnect, unsigned int nMaxConnect, bool darkSendMaster=false);
 bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound = NULL, const char *strDest = NULL, bool fOneShot = false);
 void MapPort(bool fUseUPnP);
 unsigned short GetListenPort();
@@ -77,6 +116,9 @@ void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode *pnode);
 
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
+
 typedef int NodeId;
 
 // Signals for message handling
@@ -129,7 +171,9 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+/** Notified to wake the message handler thread when work arrives for it */
+extern boost::condition_variable messageHandlerCondition;
+extern std::map<CInv, CSerializeDataRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -148,6 +192,54 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Priority classes of the upload limiter, most important first. */
+enum UploadClass
+{
+    UPLOAD_BLOCK_RELAY = 0,     // new blocks and everything else we relay
+    UPLOAD_HISTORICAL_BLOCK,    // old blocks served to peers catching up
+    UPLOAD_THRONE_LIST,         // throne list entries requested with dseg
+};
+
+/**
+ * Token bucket shaping our upload rate (-maxuploadrate). Every byte sent
+ * takes a token, and the bucket refills at the configured rate up to one
+ * burst. Relay traffic is never held back but still drains the bucket, so
+ * the lower classes yield to it: historical blocks are only served while a
+ * quarter of the burst is left, throne list entries while half of it is.
+ */
+class CUploadLimiter
+{
+private:
+    CCriticalSection cs;
+    int64_t nRate;          // bytes per second, 0 if unlimited
+    int64_t nBurst;         // bucket size in bytes
+    int64_t nTokens;        // may go negative down to -nBurst after relay traffic
+    int64_t nLastRefill;    // in microseconds
+
+    void Refill(int64_t nNow);
+
+public:
+    CUploadLimiter();
+
+    void SetRate(int64_t nRateIn, int64_t nNow);
+    bool IsLimited();
+    /** Whether data of the given class may be sent now. */
+    bool Allow(UploadClass nClass, int64_t nNow);
+    void Consume(uint64_t nBytes, int64_t nNow);
+};
+
+extern CUploadLimiter uploadLimiter;
+
+/** Messages and bytes exchanged with a peer for one command */
+struct CMsgCmdCount
+{
+    uint64_t nMessages;
+    uint64_t nBytes;
+
+    CMsgCmdCount() : nMessages(0), nBytes(0) {}
+};
+typedef std::map<std::string, CMsgCmdCount> mapMsgCmdCount;
+
 class CNodeStats
 {
 public:
@@ -163,6 +255,8 @@ public:
     int nStartingHeight;
     uint64_t nSendBytes;
     uint64_t nRecvBytes;
+    mapMsgCmdCount mapSendPerMsgCmd;
+    mapMsgCmdCount mapRecvPerMsgCmd;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -176,23 +270,25 @@ class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char pchHdrBuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CDataStream vRecv;              // received message data, in a pooled buffer
     unsigned int nDataPos;
+    CHash256 hasher;                // checksum of the data received so far
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
 
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -202,10 +298,12 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
+    /** Double-SHA256 of the message data, only meaningful once complete() */
+    uint256 GetMessageHash() const;
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
 };
@@ -225,14 +323,25 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializeDataRef> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Set by ProcessMessages when the next message waits for a lane that
+    // another message handler thread holds, so the caller may sleep.
+    bool fRecvLaneBusy;
+    // Set by ProcessGetData when the upload limiter holds the next requested
+    // item back, so the caller may sleep until tokens are refilled.
+    bool fUploadThrottled;
     uint64_t nRecvBytes;
     int nRecvVersion;
+    // Readiness of hSocket as last reported to the socket handler thread, which
+    // is the only one to touch these. With epoll they are edge-triggered and
+    // stay set until a recv or send on the socket would block.
+    bool fPollRecv;
+    bool fPollSend;
 
     int64_t nLastSend;
     int64_t nLastRecv;
@@ -286,19 +395,31 @@ protected:
     // Basic fuzz-testing
     void Fuzz(int nChance); // modifies ssSend
 
+    // Per-command traffic, shown in getpeerinfo
+    CCriticalSection cs_mapMsgCmdCount;
+    mapMsgCmdCount mapSendPerMsgCmd;
+    mapMsgCmdCount mapRecvPerMsgCmd;
+    void RecordMessage(mapMsgCmdCount& mapPerMsgCmd, const std::string& strCommand, uint64_t nBytes);
+
 public:
     uint256 hashContinue;
     int nStartingHeight;
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
-    mruset<CAddress> setAddrKnown;
+    CRollingBloomFilter filterAddrKnown;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
+    // Non-transaction inventory (blocks, throne/budget/instantx items) is
+    // announced on the next SendMessages call.
     std::vector<CInv> vInventoryToSend;
+    // Transactions are queued separately and announced in batches, highest
+    // feerate first, whenever nNextInvSend expires.
+    std::set<uint256> setInventoryTxToSend;
+    int64_t nNextInvSend;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
 
@@ -370,9 +491,14 @@ public:
 
 
 
+    bool IsAddressKnown(const CAddress& addr) const
+    {
+        return filterAddrKnown.contains(addr.GetKey());
+    }
+
     void AddAddressKnown(const CAddress& addr)
     {
-        setAddrKnown.insert(addr);
+        filterAddrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
@@ -380,7 +506,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
-        if (addr.IsValid() && !setAddrKnown.count(addr)) {
+        if (addr.IsValid() && !IsAddressKnown(addr)) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
             } else {
@@ -390,11 +516,27 @@ public:
     }
 
 
+    // Key under which an inventory item is stored in filterInventoryKnown.
+    // The type is part of the key: instantx lock requests share the hash of
+    // the transaction they lock.
+    static std::vector<unsigned char> GetInventoryKey(const CInv& inv)
+    {
+        std::vector<unsigned char> vKey(inv.hash.begin(), inv.hash.end());
+        vKey.push_back((unsigned char)inv.type);
+        return vKey;
+    }
+
+    // requires LOCK(cs_inventory)
+    bool IsInventoryKnown(const CInv& inv) const
+    {
+        return filterInventoryKnown.contains(GetInventoryKey(inv));
+    }
+
     void AddInventoryKnown(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(GetInventoryKey(inv));
         }
     }
 
@@ -402,7 +544,11 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (IsInventoryKnown(inv))
+                return;
+            if (inv.type == MSG_TX)
+                setInventoryTxToSend.insert(inv.hash);
+            else
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -420,6 +566,32 @@ public:
 
     void PushVersion();
 
+    /** Queue a message built by MakeMessage without copying it. */
+    void PushSharedMessage(const char* pszCommand, const CSerializeDataRef& msg);
+
+    /** Start a message for pszCommand in the empty stream ss. */
+    static void BeginMessageHeader(CDataStream& ss, const char* pszCommand);
+
+    /** Fill in the size and checksum of the message in ss, returns the payload size. */
+    static unsigned int FinalizeMessageHeader(CDataStream& ss);
+
+    /**
+     * Serialize a complete message once so it can be sent to any number of
+     * peers. Block and transaction encodings don't depend on the peer's
+     * protocol version, only use this for such payloads.
+     */
+    template<typename T>
+    static CSerializeDataRef MakeMessage(const char* pszCommand, const T& obj)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        BeginMessageHeader(ss, pszCommand);
+        ss << obj;
+        FinalizeMessageHeader(ss);
+        boost::shared_ptr<CSerializeData> msg(new CSerializeData());
+        ss.GetAndClear(*msg);
+        return msg;
+    }
+
 
     void PushMessage(const char* pszCommand)
     {
@@ -689,6 +861,60 @@ public:
     static uint64_t GetTotalBytesSent();
 };
 
+/** Format of the entries in a "batch" envelope, sent as its first byte */
+enum BatchFormat
+{
+    BATCH_PLAIN = 0,
+    BATCH_ZLIB = 1
+};
+
+/**
+ * Packs small messages to one peer into "batch" envelopes, which peers from
+ * BATCH_VERSION on unpack and process in order. List syncs answer with
+ * thousands of small items, and batching saves the header, checksum and send
+ * call of each. The entries are deflated when that makes the envelope
+ * smaller: items of one sync repeat throne inputs, ping block hashes and
+ * proposal hashes, and a throne list envelope shrinks by about half. Older
+ * peers get the messages one by one as before. Only the throne, budget,
+ * instantx and spork items listed in IsBatchable may be batched, and
+ * receivers reject anything else. Whatever is left is sent on destruction.
+ */
+class CMessageBatch
+{
+private:
+    CNode* pnode;
+    CDataStream ssBatch;
+    unsigned int nMessages;
+
+public:
+    CMessageBatch(CNode* pnodeIn) : pnode(pnodeIn), ssBatch(SER_NETWORK, PROTOCOL_VERSION), nMessages(0) {}
+    ~CMessageBatch() { Flush(); }
+
+    /** Whether strCommand may be carried in a batch envelope */
+    static bool IsBatchable(const std::string& strCommand);
+    /** Read the envelope in vRecv into its entries; false if it is malformed or inflates too far */
+    static bool Unpack(CDataStream& vRecv, CDataStream& ssEntries);
+
+    template<typename T>
+    void PushMessage(const char* pszCommand, const T& obj)
+    {
+        assert(IsBatchable(pszCommand));
+        if (pnode->nVersion < BATCH_VERSION) {
+            pnode->PushMessage(pszCommand, obj);
+            return;
+        }
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << obj;
+        ssBatch << std::string(pszCommand);
+        WriteCompactSize(ssBatch, ss.size());
+        ssBatch << ss;
+        if (++nMessages >= MAX_BATCH_MESSAGES || ssBatch.size() >= MAX_BATCH_SIZE)
+            Flush();
+    }
+
+    void Flush();
+};
+
 class CExplicitNetCleanup
 {
 public:
@@ -697,10 +923,15 @@ public:
 
 class CTransaction;
 void RelayTransaction(const CTransaction& tx);
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
+void RelayTransaction(const CTransaction& tx, const CSerializeDataRef& msg);
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll=false);    
 void RelayInv(CInv &inv, const int minProtoVersion = MIN_PEER_PROTO_VERSION);
 
+/** Look up a message previously stored by CacheMessage, NULL if there is none. */
+CSerializeDataRef GetCachedMessage(const CInv& inv);
+/** Keep a serialized block or transaction message around for the next peer asking for inv. */
+void CacheMessage(const CInv& inv, const CSerializeDataRef& msg);
+
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
 {
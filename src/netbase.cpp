@@ -26,6 +26,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <poll.h>
+#endif
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
 #include <boost/thread.hpp>
@@ -270,11 +274,16 @@ bool static InterruptibleRecv(char* data, size_t len, int timeout, SOCKET& hSock
                 if (!IsSelectableSocket(hSocket)) {
                     return false;
                 }
+#ifdef USE_EPOLL
+                struct pollfd pollfd = { (int)hSocket, POLLIN, 0 };
+                int nRet = poll(&pollfd, 1, std::min(endTime - curTime, maxWait));
+#else
                 struct timeval tval = MillisToTimeval(std::min(endTime - curTime, maxWait));
                 fd_set fdset;
                 FD_ZERO(&fdset);
                 FD_SET(hSocket, &fdset);
                 int nRet = select(hSocket + 1, &fdset, NULL, NULL, &tval);
+#endif
                 if (nRet == SOCKET_ERROR) {
                     return false;
                 }
@@ -392,9 +401,15 @@ bool static Socks5(string strDest, int port, SOCKET& hSocket)
     return true;
 }
 
-bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRet, int nTimeout)
+/**
+ * Create a non-blocking socket and start connecting it to addrConnect.
+ * fInProgress is set if the connection is still being established and
+ * needs FinishConnectSocket once the socket becomes writable.
+ */
+bool static StartConnectSocket(const CService &addrConnect, SOCKET& hSocketRet, bool& fInProgress)
 {
     hSocketRet = INVALID_SOCKET;
+    fInProgress = false;
 
     struct sockaddr_storage sockaddr;
     socklen_t len = sizeof(sockaddr);
@@ -429,58 +444,209 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
         int nErr = WSAGetLastError();
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
-        {
-            struct timeval timeout = MillisToTimeval(nTimeout);
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
-            if (nRet == 0)
-            {
-                LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
-                CloseSocket(hSocket);
-                return false;
-            }
-            if (nRet == SOCKET_ERROR)
-            {
-                LogPrintf("select() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
-                CloseSocket(hSocket);
-                return false;
-            }
-            socklen_t nRetSize = sizeof(nRet);
+            fInProgress = true;
 #ifdef WIN32
-            if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, (char*)(&nRet), &nRetSize) == SOCKET_ERROR)
+        else if (nErr != WSAEISCONN)
 #else
-            if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, &nRet, &nRetSize) == SOCKET_ERROR)
+        else
 #endif
-            {
-                LogPrintf("getsockopt() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
-                CloseSocket(hSocket);
-                return false;
-            }
-            if (nRet != 0)
-            {
-                LogPrintf("connect() to %s failed after select(): %s\n", addrConnect.ToString(), NetworkErrorString(nRet));
-                CloseSocket(hSocket);
-                return false;
-            }
+        {
+            LogPrintf("connect() to %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(nErr));
+            CloseSocket(hSocket);
+            return false;
         }
+    }
+
+    hSocketRet = hSocket;
+    return true;
+}
+
+/** Check the outcome of a connect started by StartConnectSocket once the socket is writable; closes it on failure */
+bool static FinishConnectSocket(const CService &addrConnect, SOCKET& hSocket)
+{
+    int nRet = 0;
+    socklen_t nRetSize = sizeof(nRet);
 #ifdef WIN32
-        else if (WSAGetLastError() != WSAEISCONN)
+    if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, (char*)(&nRet), &nRetSize) == SOCKET_ERROR)
 #else
-        else
+    if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, &nRet, &nRetSize) == SOCKET_ERROR)
+#endif
+    {
+        LogPrintf("getsockopt() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
+        CloseSocket(hSocket);
+        return false;
+    }
+    if (nRet != 0)
+    {
+        LogPrintf("connect() to %s failed after select(): %s\n", addrConnect.ToString(), NetworkErrorString(nRet));
+        CloseSocket(hSocket);
+        return false;
+    }
+    return true;
+}
+
+bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRet, int nTimeout)
+{
+    SOCKET hSocket;
+    bool fInProgress;
+    if (!StartConnectSocket(addrConnect, hSocket, fInProgress))
+        return false;
+
+    if (fInProgress)
+    {
+#ifdef USE_EPOLL
+        struct pollfd pollfd = { (int)hSocket, POLLOUT, 0 };
+        int nRet = poll(&pollfd, 1, nTimeout);
+#else
+        struct timeval timeout = MillisToTimeval(nTimeout);
+        fd_set fdset;
+        FD_ZERO(&fdset);
+        FD_SET(hSocket, &fdset);
+        int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
 #endif
+        if (nRet == 0)
         {
-            LogPrintf("connect() to %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
+            LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
             CloseSocket(hSocket);
             return false;
         }
+        if (nRet == SOCKET_ERROR)
+        {
+            LogPrintf("select() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
+            CloseSocket(hSocket);
+            return false;
+        }
+        if (!FinishConnectSocket(addrConnect, hSocket))
+            return false;
     }
 
     hSocketRet = hSocket;
     return true;
 }
 
+size_t ConnectSocketsParallel(const std::vector<CService> &vAddrConnect, std::vector<SOCKET>& vSocketRet, std::vector<bool>& vFailedRet, unsigned int nMaxConnect, int nTimeout, int nStagger)
+{
+    vSocketRet.assign(vAddrConnect.size(), INVALID_SOCKET);
+    vFailedRet.assign(vAddrConnect.size(), false);
+    std::vector<SOCKET> vPending(vAddrConnect.size(), INVALID_SOCKET);
+    std::vector<int64_t> vDeadline(vAddrConnect.size(), 0);
+    size_t nStarted = 0, nPending = 0;
+    unsigned int nConnected = 0;
+    int64_t nNextStart = GetTimeMillis();
+
+    while (nConnected < nMaxConnect && (nPending > 0 || nStarted < vAddrConnect.size()))
+    {
+        int64_t nNow = GetTimeMillis();
+
+        // Start the next candidate when its turn comes up, or straight away
+        // when nothing else is in flight (the previous attempt failed fast)
+        if (nStarted < vAddrConnect.size() && (nPending == 0 || nNow >= nNextStart))
+        {
+            size_t i = nStarted++;
+            bool fInProgress;
+            if (!StartConnectSocket(vAddrConnect[i], vPending[i], fInProgress)) {
+                vFailedRet[i] = true;
+                continue;
+            }
+            if (!fInProgress) {
+                std::swap(vSocketRet[i], vPending[i]);
+                nConnected++;
+                continue;
+            }
+#ifndef USE_EPOLL
+            if (!IsSelectableSocket(vPending[i])) {
+                LogPrintf("Cannot connect to %s: non-selectable socket created (fd >= FD_SETSIZE ?)\n", vAddrConnect[i].ToString());
+                CloseSocket(vPending[i]);
+                continue;
+            }
+#endif
+            vDeadline[i] = nNow + nTimeout;
+            nNextStart = nNow + nStagger;
+            nPending++;
+            continue;
+        }
+
+        // Wait until a pending connect completes, the earliest one times out
+        // or the next candidate is due
+        int64_t nWaitUntil = nStarted < vAddrConnect.size() ? nNextStart : std::numeric_limits<int64_t>::max();
+#ifdef USE_EPOLL
+        std::vector<struct pollfd> vPollFd;
+        std::vector<size_t> vPollIndex;
+#else
+        fd_set fdsetSend, fdsetError;
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        SOCKET hSocketMax = 0;
+#endif
+        for (size_t i = 0; i < nStarted; i++) {
+            if (vPending[i] == INVALID_SOCKET)
+                continue;
+            nWaitUntil = std::min(nWaitUntil, vDeadline[i]);
+#ifdef USE_EPOLL
+            struct pollfd pollfd = { (int)vPending[i], POLLOUT, 0 };
+            vPollFd.push_back(pollfd);
+            vPollIndex.push_back(i);
+#else
+            FD_SET(vPending[i], &fdsetSend);
+            FD_SET(vPending[i], &fdsetError);
+            hSocketMax = std::max(hSocketMax, vPending[i]);
+#endif
+        }
+        int nWait = (int)std::max((int64_t)0, nWaitUntil - nNow);
+#ifdef USE_EPOLL
+        int nRet = poll(&vPollFd[0], vPollFd.size(), nWait);
+#else
+        struct timeval timeout = MillisToTimeval(nWait);
+        int nRet = select(hSocketMax + 1, NULL, &fdsetSend, &fdsetError, &timeout);
+#endif
+        if (nRet == SOCKET_ERROR) {
+            LogPrintf("select() for parallel connect failed: %s\n", NetworkErrorString(WSAGetLastError()));
+            break;
+        }
+
+        nNow = GetTimeMillis();
+#ifdef USE_EPOLL
+        for (size_t n = 0; n < vPollFd.size(); n++) {
+            size_t i = vPollIndex[n];
+            bool fReady = vPollFd[n].revents != 0;
+#else
+        for (size_t i = 0; i < nStarted; i++) {
+            if (vPending[i] == INVALID_SOCKET)
+                continue;
+            bool fReady = FD_ISSET(vPending[i], &fdsetSend) || FD_ISSET(vPending[i], &fdsetError);
+#endif
+            if (fReady) {
+                nPending--;
+                if (!FinishConnectSocket(vAddrConnect[i], vPending[i])) {
+                    // Failed: give the next candidate its turn right away
+                    vFailedRet[i] = true;
+                    CloseSocket(vPending[i]);
+                    nNextStart = nNow;
+                } else if (nConnected < nMaxConnect) {
+                    std::swap(vSocketRet[i], vPending[i]);
+                    nConnected++;
+                } else {
+                    // Connected, but enough others already did
+                    CloseSocket(vPending[i]);
+                }
+            } else if (nNow >= vDeadline[i]) {
+                LogPrint("net", "connection to %s timeout\n", vAddrConnect[i].ToString());
+                vFailedRet[i] = true;
+                CloseSocket(vPending[i]);
+                nPending--;
+                nNextStart = nNow;
+            }
+        }
+    }
+
+    // Drop the attempts that lost the race
+    for (size_t i = 0; i < nStarted; i++)
+        if (vPending[i] != INVALID_SOCKET)
+            CloseSocket(vPending[i]);
+
+    return nStarted;
+}
+
 bool SetProxy(enum Network net, CService addrProxy) {
     assert(net >= 0 && net < NET_MAX);
     if (!addrProxy.IsValid())
@@ -186,6 +186,15 @@ bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault =
 bool LookupNumeric(const char *pszName, CService& addr, int portDefault = 0);
 bool ConnectSocket(const CService &addr, SOCKET& hSocketRet, int nTimeout, bool *outProxyConnectionFailed = 0);
 bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest, int portDefault, int nTimeout, bool *outProxyConnectionFailed = 0);
+/**
+ * Race direct connections to several candidates, starting a new attempt every
+ * nStagger milliseconds (or as soon as one fails) until nMaxConnect succeeded.
+ * vSocketRet holds the connected sockets by candidate index, vFailedRet marks the
+ * candidates that refused or timed out (not those dropped once enough had
+ * connected). Returns how many candidates were tried; those are always a
+ * prefix of vAddrConnect.
+ */
+size_t ConnectSocketsParallel(const std::vector<CService> &vAddrConnect, std::vector<SOCKET>& vSocketRet, std::vector<bool>& vFailedRet, unsigned int nMaxConnect, int nTimeout, int nStagger);
 /** Return readable error string for a network error code */
 std::string NetworkErrorString(int err);
 /** Close socket and set hSocket to INVALID_SOCKET */
@@ -9,6 +9,7 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "primitives/block.h"
+#include "sync.h"
 #include "uint256.h"
 #include "util.h"
 
@@ -71,6 +72,65 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast) {
     return bnNew.GetCompact();
 }
 
+namespace {
+/**
+ * DarkGravityWave results keyed by the hash of the block they follow.
+ *
+ * The average is anchored at the newest block and truncated at every step,
+ * so a child's target cannot be derived from its parent's one. Instead each
+ * parent is computed once and reused by header sync, block acceptance,
+ * competing children and every block template built on it. Direct-mapped
+ * and fixed-size; a colliding entry is simply overwritten.
+ */
+class CRetargetCache
+{
+private:
+    struct Entry {
+        uint256 hash;
+        unsigned int nBits;
+    };
+    static const size_t SIZE = 1024;
+
+    CCriticalSection cs;
+    Entry entries[SIZE];
+
+public:
+    bool Get(const uint256& hash, unsigned int& nBits)
+    {
+        LOCK(cs);
+        const Entry& entry = entries[hash.GetCheapHash() % SIZE];
+        if (entry.hash != hash)
+            return false;
+        nBits = entry.nBits;
+        return true;
+    }
+
+    void Set(const uint256& hash, unsigned int nBits)
+    {
+        LOCK(cs);
+        Entry& entry = entries[hash.GetCheapHash() % SIZE];
+        entry.hash = hash;
+        entry.nBits = nBits;
+    }
+};
+
+CRetargetCache retargetCache;
+}
+
+unsigned int static DarkGravityWaveCached(const CBlockIndex* pindexLast)
+{
+    if (pindexLast == NULL || pindexLast->phashBlock == NULL)
+        return DarkGravityWave(pindexLast);
+
+    const uint256 hash = pindexLast->GetBlockHash();
+    unsigned int nBits;
+    if (!retargetCache.Get(hash, nBits)) {
+        nBits = DarkGravityWave(pindexLast);
+        retargetCache.Set(hash, nBits);
+    }
+    return nBits;
+}
+
 unsigned int GetNextWorkRequiredV2(const CBlockIndex* pindexLast, const CBlockHeader *pblock)
 {
     unsigned int nProofOfWorkLimit = Params().ProofOfWorkLimit().GetCompact();
@@ -332,7 +392,7 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     } else if (pindexLast->nHeight > 181200 && pindexLast->nHeight < 833000) {
         return GetNextWorkRequiredV2(pindexLast, pblock);
     } else {
-        return DarkGravityWave(pindexLast);
+        return DarkGravityWaveCached(pindexLast);
     }
 
     return GetNextWorkRequiredV2(pindexLast, pblock);
@@ -0,0 +1,360 @@
+// Copyright (c) 2015 The Terracoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PREVECTOR_H
+#define BITCOIN_PREVECTOR_H
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma pack(push, 1)
+/** Implements a drop-in replacement for std::vector<T> which stores up to N
+ *  elements directly (without heap allocation). The types Size and Diff are
+ *  used to store element counts, and can be any unsigned + signed type.
+ *
+ *  Storage layout is either:
+ *  - Direct allocation:
+ *    - Size _size: the number of used elements (between 0 and N)
+ *    - T direct[N]: an array of N elements of type T
+ *  - Indirect allocation:
+ *    - Size _size: the number of used elements plus N + 1
+ *    - Size capacity: the number of allocated elements
+ *    - T* indirect: a pointer to an array of capacity elements of type T
+ *
+ *  T must be a POD type: elements are moved around with memcpy/memmove and
+ *  never individually constructed or destroyed.
+ *
+ *  Like std::vector, iterators are invalidated by anything that grows the
+ *  container, and inserting a range taken from the container itself is not
+ *  supported.
+ */
+template<unsigned int N, typename T, typename Size = uint32_t, typename Diff = int32_t>
+class prevector {
+public:
+    typedef Size size_type;
+    typedef Diff difference_type;
+    typedef T value_type;
+    typedef value_type& reference;
+    typedef const value_type& const_reference;
+    typedef value_type* pointer;
+    typedef const value_type* const_pointer;
+
+    class iterator {
+        T* ptr;
+    public:
+        typedef Diff difference_type;
+        typedef T value_type;
+        typedef T* pointer;
+        typedef T& reference;
+        typedef std::random_access_iterator_tag iterator_category;
+        iterator() : ptr(NULL) {}
+        explicit iterator(T* ptr_) : ptr(ptr_) {}
+        T& operator*() const { return *ptr; }
+        T* operator->() const { return ptr; }
+        T& operator[](difference_type pos) const { return ptr[pos]; }
+        iterator& operator++() { ptr++; return *this; }
+        iterator& operator--() { ptr--; return *this; }
+        iterator operator++(int) { iterator copy(*this); ++(*this); return copy; }
+        iterator operator--(int) { iterator copy(*this); --(*this); return copy; }
+        difference_type friend operator-(iterator a, iterator b) { return a.ptr - b.ptr; }
+        iterator operator+(difference_type n) const { return iterator(ptr + n); }
+        iterator& operator+=(difference_type n) { ptr += n; return *this; }
+        iterator operator-(difference_type n) const { return iterator(ptr - n); }
+        iterator& operator-=(difference_type n) { ptr -= n; return *this; }
+        bool operator==(iterator x) const { return ptr == x.ptr; }
+        bool operator!=(iterator x) const { return ptr != x.ptr; }
+        bool operator>=(iterator x) const { return ptr >= x.ptr; }
+        bool operator<=(iterator x) const { return ptr <= x.ptr; }
+        bool operator>(iterator x) const { return ptr > x.ptr; }
+        bool operator<(iterator x) const { return ptr < x.ptr; }
+    };
+
+    class const_iterator {
+        const T* ptr;
+    public:
+        typedef Diff difference_type;
+        typedef const T value_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+        typedef std::random_access_iterator_tag iterator_category;
+        const_iterator() : ptr(NULL) {}
+        explicit const_iterator(const T* ptr_) : ptr(ptr_) {}
+        const_iterator(iterator x) : ptr(&(*x)) {}
+        const T& operator*() const { return *ptr; }
+        const T* operator->() const { return ptr; }
+        const T& operator[](difference_type pos) const { return ptr[pos]; }
+        const_iterator& operator++() { ptr++; return *this; }
+        const_iterator& operator--() { ptr--; return *this; }
+        const_iterator operator++(int) { const_iterator copy(*this); ++(*this); return copy; }
+        const_iterator operator--(int) { const_iterator copy(*this); --(*this); return copy; }
+        difference_type friend operator-(const_iterator a, const_iterator b) { return a.ptr - b.ptr; }
+        const_iterator operator+(difference_type n) const { return const_iterator(ptr + n); }
+        const_iterator& operator+=(difference_type n) { ptr += n; return *this; }
+        const_iterator operator-(difference_type n) const { return const_iterator(ptr - n); }
+        const_iterator& operator-=(difference_type n) { ptr -= n; return *this; }
+        bool operator==(const_iterator x) const { return ptr == x.ptr; }
+        bool operator!=(const_iterator x) const { return ptr != x.ptr; }
+        bool operator>=(const_iterator x) const { return ptr >= x.ptr; }
+        bool operator<=(const_iterator x) const { return ptr <= x.ptr; }
+        bool operator>(const_iterator x) const { return ptr > x.ptr; }
+        bool operator<(const_iterator x) const { return ptr < x.ptr; }
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+private:
+    size_type _size;
+    union direct_or_indirect {
+        char direct[sizeof(T) * N];
+        struct {
+            size_type capacity;
+            char* indirect;
+        } ind;
+    } _union;
+
+    T* direct_ptr(difference_type pos) { return reinterpret_cast<T*>(_union.direct) + pos; }
+    const T* direct_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.direct) + pos; }
+    T* indirect_ptr(difference_type pos) { return reinterpret_cast<T*>(_union.ind.indirect) + pos; }
+    const T* indirect_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.ind.indirect) + pos; }
+    bool is_direct() const { return _size <= N; }
+
+    T* item_ptr(difference_type pos) { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
+    const T* item_ptr(difference_type pos) const { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
+
+    void set_size(size_type new_size) { _size = is_direct() ? new_size : new_size + N + 1; }
+
+    void change_capacity(size_type new_capacity) {
+        if (new_capacity <= N) {
+            if (!is_direct()) {
+                char* indirect = _union.ind.indirect;
+                size_type n = size();
+                memcpy(_union.direct, indirect, n * sizeof(T));
+                free(indirect);
+                _size = n;
+            }
+        } else if (!is_direct()) {
+            char* new_indirect = static_cast<char*>(realloc(_union.ind.indirect, (size_t)sizeof(T) * new_capacity));
+            if (!new_indirect)
+                throw std::bad_alloc();
+            _union.ind.indirect = new_indirect;
+            _union.ind.capacity = new_capacity;
+        } else {
+            char* new_indirect = static_cast<char*>(malloc((size_t)sizeof(T) * new_capacity));
+            if (!new_indirect)
+                throw std::bad_alloc();
+            size_type n = size();
+            memcpy(new_indirect, _union.direct, n * sizeof(T));
+            _union.ind.indirect = new_indirect;
+            _union.ind.capacity = new_capacity;
+            _size = n + N + 1;
+        }
+    }
+
+    template<typename InputIterator>
+    void fill(T* dst, InputIterator first, InputIterator last) {
+        while (first != last)
+            *dst++ = *first++;
+    }
+
+public:
+    prevector() : _size(0) {}
+
+    explicit prevector(size_type n) : _size(0) {
+        resize(n);
+    }
+
+    explicit prevector(size_type n, const T& val) : _size(0) {
+        change_capacity(n);
+        std::fill(item_ptr(0), item_ptr(n), val);
+        set_size(n);
+    }
+
+    template<typename InputIterator>
+    prevector(InputIterator first, InputIterator last) : _size(0) {
+        size_type n = std::distance(first, last);
+        change_capacity(n);
+        fill(item_ptr(0), first, last);
+        set_size(n);
+    }
+
+    prevector(const prevector<N, T, Size, Diff>& other) : _size(0) {
+        change_capacity(other.size());
+        memcpy(item_ptr(0), other.item_ptr(0), other.size() * sizeof(T));
+        set_size(other.size());
+    }
+
+    ~prevector() {
+        if (!is_direct())
+            free(_union.ind.indirect);
+    }
+
+    prevector& operator=(const prevector<N, T, Size, Diff>& other) {
+        if (&other == this)
+            return *this;
+        if (capacity() < other.size())
+            change_capacity(other.size());
+        memcpy(item_ptr(0), other.item_ptr(0), other.size() * sizeof(T));
+        set_size(other.size());
+        return *this;
+    }
+
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last) {
+        size_type n = std::distance(first, last);
+        if (capacity() < n)
+            change_capacity(n);
+        fill(item_ptr(0), first, last);
+        set_size(n);
+    }
+
+    size_type size() const {
+        return is_direct() ? _size : _size - N - 1;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    iterator begin() { return iterator(item_ptr(0)); }
+    const_iterator begin() const { return const_iterator(item_ptr(0)); }
+    iterator end() { return iterator(item_ptr(size())); }
+    const_iterator end() const { return const_iterator(item_ptr(size())); }
+
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    size_t capacity() const {
+        return is_direct() ? N : _union.ind.capacity;
+    }
+
+    T& operator[](size_type pos) { return *item_ptr(pos); }
+    const T& operator[](size_type pos) const { return *item_ptr(pos); }
+
+    void resize(size_type new_size) {
+        size_type cur_size = size();
+        if (new_size > capacity())
+            change_capacity(new_size);
+        if (new_size > cur_size)
+            std::fill(item_ptr(cur_size), item_ptr(new_size), T());
+        set_size(new_size);
+    }
+
+    void reserve(size_type new_capacity) {
+        if (new_capacity > capacity())
+            change_capacity(new_capacity);
+    }
+
+    void shrink_to_fit() {
+        change_capacity(size());
+    }
+
+    void clear() {
+        set_size(0);
+    }
+
+    iterator insert(iterator pos, const T& value) {
+        size_type p = pos - begin();
+        size_type new_size = size() + 1;
+        T copy = value; // value may live in our own storage
+        if (capacity() < new_size)
+            change_capacity(new_size + (new_size >> 1));
+        memmove(item_ptr(p + 1), item_ptr(p), (size() - p) * sizeof(T));
+        *item_ptr(p) = copy;
+        set_size(new_size);
+        return iterator(item_ptr(p));
+    }
+
+    void insert(iterator pos, size_type count, const T& value) {
+        size_type p = pos - begin();
+        size_type new_size = size() + count;
+        T copy = value;
+        if (capacity() < new_size)
+            change_capacity(new_size + (new_size >> 1));
+        memmove(item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
+        std::fill(item_ptr(p), item_ptr(p + count), copy);
+        set_size(new_size);
+    }
+
+    template<typename InputIterator>
+    void insert(iterator pos, InputIterator first, InputIterator last) {
+        size_type p = pos - begin();
+        difference_type count = std::distance(first, last);
+        size_type new_size = size() + count;
+        if (capacity() < new_size)
+            change_capacity(new_size + (new_size >> 1));
+        memmove(item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
+        fill(item_ptr(p), first, last);
+        set_size(new_size);
+    }
+
+    iterator erase(iterator pos) {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(iterator first, iterator last) {
+        size_type p = first - begin();
+        size_type count = last - first;
+        memmove(item_ptr(p), item_ptr(p + count), (size() - p - count) * sizeof(T));
+        set_size(size() - count);
+        return iterator(item_ptr(p));
+    }
+
+    void push_back(const T& value) {
+        size_type new_size = size() + 1;
+        T copy = value;
+        if (capacity() < new_size)
+            change_capacity(new_size + (new_size >> 1));
+        *item_ptr(new_size - 1) = copy;
+        set_size(new_size);
+    }
+
+    void pop_back() {
+        set_size(size() - 1);
+    }
+
+    T& front() { return *item_ptr(0); }
+    const T& front() const { return *item_ptr(0); }
+    T& back() { return *item_ptr(size() - 1); }
+    const T& back() const { return *item_ptr(size() - 1); }
+
+    T* data() { return item_ptr(0); }
+    const T* data() const { return item_ptr(0); }
+
+    void swap(prevector<N, T, Size, Diff>& other) {
+        // Members are packed, so swap by value rather than through std::swap's references
+        direct_or_indirect tmp_union = _union;
+        _union = other._union;
+        other._union = tmp_union;
+        size_type tmp_size = _size;
+        _size = other._size;
+        other._size = tmp_size;
+    }
+
+    bool operator==(const prevector<N, T, Size, Diff>& other) const {
+        return size() == other.size() && memcmp(item_ptr(0), other.item_ptr(0), size() * sizeof(T)) == 0;
+    }
+
+    bool operator!=(const prevector<N, T, Size, Diff>& other) const {
+        return !(*this == other);
+    }
+
+    bool operator<(const prevector<N, T, Size, Diff>& other) const {
+        // Same ordering as std::vector, so sorted containers of scripts keep their order
+        return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+    }
+
+    size_t allocated_memory() const {
+        return is_direct() ? 0 : (size_t)sizeof(T) * _union.ind.capacity;
+    }
+};
+#pragma pack(pop)
+
+#endif // BITCOIN_PREVECTOR_H
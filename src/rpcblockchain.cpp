@@ -5,6 +5,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "checkpoints.h"
+#include "cuckoocache.h"
 #include "main.h"
 #include "rpcserver.h"
 #include "sync.h"
@@ -528,7 +529,14 @@ Value getblockchaininfo(const Array& params, bool fHelp)
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"sigcache\": {            (object) signature cache statistics\n"
+            "     \"size\": xxxxx,          (numeric) number of entries the cache holds\n"
+            "     \"usage\": xxxxx,         (numeric) memory allocated to the cache in bytes\n"
+            "     \"hits\": xxxxx,          (numeric) signature checks answered from the cache\n"
+            "     \"misses\": xxxxx,        (numeric) signature checks not found in the cache\n"
+            "     \"inserts\": xxxxx        (numeric) signatures added to the cache\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblockchaininfo", "")
@@ -543,6 +551,16 @@ Value getblockchaininfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
+
+    CCuckooCacheStats sigcache;
+    GetSignatureCacheStats(sigcache);
+    Object objSigCache;
+    objSigCache.push_back(Pair("size",          (uint64_t)sigcache.nSlots));
+    objSigCache.push_back(Pair("usage",         (uint64_t)sigcache.nBytes));
+    objSigCache.push_back(Pair("hits",          sigcache.nHits));
+    objSigCache.push_back(Pair("misses",        sigcache.nMisses));
+    objSigCache.push_back(Pair("inserts",       sigcache.nInserts));
+    obj.push_back(Pair("sigcache",              objSigCache));
     return obj;
 }
 
@@ -76,6 +76,18 @@ static void CopyNodeStats(std::vector<CNodeStats>& vstats)
     }
 }
 
+static Object MsgCmdCountToJSON(const mapMsgCmdCount& mapPerMsgCmd)
+{
+    Object obj;
+    BOOST_FOREACH(const PAIRTYPE(std::string, CMsgCmdCount)& item, mapPerMsgCmd) {
+        Object count;
+        count.push_back(Pair("messages", item.second.nMessages));
+        count.push_back(Pair("bytes", item.second.nBytes));
+        obj.push_back(Pair(item.first, count));
+    }
+    return obj;
+}
+
 Value getpeerinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -93,6 +105,14 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"sent_per_msg\": {           (json object) Messages and bytes sent per message type\n"
+            "       \"command\": { \"messages\": n, \"bytes\": n },\n"
+            "       ...\n"
+            "    },\n"
+            "    \"recv_per_msg\": {           (json object) Messages and bytes received per message type\n"
+            "       \"command\": { \"messages\": n, \"bytes\": n },\n"
+            "       ...\n"
+            "    },\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
@@ -106,7 +126,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"inflightmax\": n,          (numeric) The number of blocks we are currently willing to have in flight from this peer\n"
+            "    \"blocklatency\": n,         (numeric) Smoothed time in milliseconds between requesting a block from this peer and receiving it\n"
+            "    \"blockthroughput\": n,      (numeric) Smoothed block download throughput from this peer in bytes per second\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -133,6 +156,8 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        obj.push_back(Pair("sent_per_msg", MsgCmdCountToJSON(stats.mapSendPerMsgCmd)));
+        obj.push_back(Pair("recv_per_msg", MsgCmdCountToJSON(stats.mapRecvPerMsgCmd)));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("pingtime", stats.dPingTime));
         if (stats.dPingWait > 0.0)
@@ -153,6 +178,9 @@ Value getpeerinfo(const Array& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflightmax", statestats.nBlocksInFlightMax));
+            obj.push_back(Pair("blocklatency", statestats.nBlockLatency / 1000));
+            obj.push_back(Pair("blockthroughput", statestats.nBlockThroughput));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
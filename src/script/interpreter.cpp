@@ -15,6 +15,8 @@
 
 using namespace std;
 
+// Stack elements stay plain vectors: next to the signature checks their
+// allocations do not show up, and standard spends skip the stack entirely.
 typedef vector<unsigned char> valtype;
 
 namespace {
@@ -1022,9 +1024,66 @@ public:
     }
 };
 
+/** Minimal stream appending serialized data to a byte vector */
+class CVectorWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+
+public:
+    CVectorWriter(std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+
+    CVectorWriter& write(const char *pch, size_t size) {
+        vch.insert(vch.end(), (const unsigned char*)pch, (const unsigned char*)pch + size);
+        return (*this);
+    }
+};
+
+/** Minimal stream feeding serialized data straight into a SHA256 hasher */
+class CSHA256Writer
+{
+private:
+    CSHA256& hasher;
+
+public:
+    CSHA256Writer(CSHA256& hasherIn) : hasher(hasherIn) {}
+
+    CSHA256Writer& write(const char *pch, size_t size) {
+        hasher.Write((const unsigned char*)pch, size);
+        return (*this);
+    }
+};
+
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& tx)
+{
+    // Under SIGHASH_ALL every input other than the one being signed is
+    // serialized with an empty script, so only the signed input's script
+    // differs between inputs
+    CVectorWriter ssInputs(vchInputs);
+    ::Serialize(ssInputs, tx.nVersion, SER_GETHASH, 0);
+    ::WriteCompactSize(ssInputs, tx.vin.size());
+    vPrefix.reserve(tx.vin.size());
+    vScriptOffset.reserve(tx.vin.size());
+    CSHA256 hasher;
+    size_t nHashed = 0;
+    for (unsigned int nInput = 0; nInput < tx.vin.size(); nInput++) {
+        ::Serialize(ssInputs, tx.vin[nInput].prevout, SER_GETHASH, 0);
+        hasher.Write(&vchInputs[nHashed], vchInputs.size() - nHashed);
+        nHashed = vchInputs.size();
+        vPrefix.push_back(hasher);
+        vScriptOffset.push_back(vchInputs.size());
+        ::Serialize(ssInputs, CScript(), SER_GETHASH, 0);
+        ::Serialize(ssInputs, tx.vin[nInput].nSequence, SER_GETHASH, 0);
+    }
+
+    CVectorWriter ssOutputs(vchOutputs);
+    ::Serialize(ssOutputs, tx.vout, SER_GETHASH, 0);
+    ::Serialize(ssOutputs, tx.nLockTime, SER_GETHASH, 0);
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* txdata)
 {
     static const uint256 one(uint256S("0000000000000000000000000000000000000000000000000000000000000001"));
     if (nIn >= txTo.vin.size()) {
@@ -1043,6 +1102,24 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    if (txdata && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        assert(txdata->vPrefix.size() == txTo.vin.size());
+        // Resume from the hasher state just before this input's script and
+        // splice the script code in place of the blank one
+        CSHA256 hasher(txdata->vPrefix[nIn]);
+        CSHA256Writer ss(hasher);
+        txTmp.SerializeScriptCode(ss, SER_GETHASH, 0);
+        size_t nAfter = txdata->vScriptOffset[nIn] + 1;
+        hasher.Write(&txdata->vchInputs[nAfter], txdata->vchInputs.size() - nAfter);
+        hasher.Write(&txdata->vchOutputs[0], txdata->vchOutputs.size());
+        ::Serialize(ss, nHashType, SER_GETHASH, 0);
+        uint256 hash;
+        hasher.Finalize(hash.begin());
+        CSHA256().Write(hash.begin(), CSHA256::OUTPUT_SIZE).Finalize(hash.begin());
+        return hash;
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1067,7 +1144,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, txdata);
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -1075,7 +1152,157 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     return true;
 }
 
+namespace {
+
+/** Collect the data pushes of scriptSig as EvalScript would leave them on the stack */
+bool GetScriptPushes(const CScript& script, unsigned int flags, vector<valtype>& vPushes)
+{
+    if (script.size() > 10000)
+        return false;
+    bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    while (pc < script.end()) {
+        vPushes.push_back(valtype());
+        if (!script.GetOp(pc, opcode, vPushes.back()) || opcode > OP_PUSHDATA4)
+            return false;
+        if (vPushes.back().size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if (fRequireMinimal && !CheckMinimalPush(vPushes.back(), opcode))
+            return false;
+    }
+    return true;
+}
+
+/** Match OP_m <pubkey>... OP_n OP_CHECKMULTISIG */
+bool MatchMultisig(const CScript& script, unsigned int flags, int& nRequired, vector<valtype>& vKeys)
+{
+    bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vch;
+    if (!script.GetOp(pc, opcode) || opcode < OP_1 || opcode > OP_16)
+        return false;
+    nRequired = CScript::DecodeOP_N(opcode);
+    while (true) {
+        if (!script.GetOp(pc, opcode, vch))
+            return false;
+        if (opcode == OP_0 || opcode > OP_PUSHDATA4)
+            break;
+        if (vch.size() > MAX_SCRIPT_ELEMENT_SIZE || (fRequireMinimal && !CheckMinimalPush(vch, opcode)))
+            return false;
+        vKeys.push_back(vch);
+    }
+    if (opcode < OP_1 || opcode > OP_16 || CScript::DecodeOP_N(opcode) != (int)vKeys.size() || nRequired > (int)vKeys.size())
+        return false;
+    return script.GetOp(pc, opcode) && opcode == OP_CHECKMULTISIG && pc == script.end();
+}
+
+bool CheckStandardSig(const valtype& vchSig, const valtype& vchPubKey, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, serror))
+        return false;
+    CScript scriptCode(script);
+    scriptCode.FindAndDelete(CScript(vchSig));
+    if (!checker.CheckSig(vchSig, vchPubKey, scriptCode))
+        return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    return true;
+}
+
+/**
+ * Check the first nStack items of stack (bottom first) against a P2PK, P2PKH or multisig script.
+ * Anything the interpreter might judge differently, or fail with another error, is left unhandled.
+ */
+StandardScriptResult VerifyStandardTemplate(const vector<valtype>& stack, size_t nStack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+        if (nStack != 2)
+            return STANDARD_SCRIPT_UNHANDLED;
+        unsigned char vchHash[CHash160::OUTPUT_SIZE];
+        CHash160().Write(begin_ptr(stack[1]), stack[1].size()).Finalize(vchHash);
+        if (memcmp(vchHash, &script[3], sizeof(vchHash)) != 0) {
+            set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+            return STANDARD_SCRIPT_INVALID;
+        }
+        if (!CheckStandardSig(stack[0], stack[1], script, flags, checker, serror))
+            return STANDARD_SCRIPT_INVALID;
+        return STANDARD_SCRIPT_VALID;
+    }
+
+    if ((script.size() == 35 || script.size() == 67) && script[0] == script.size() - 2 && script.back() == OP_CHECKSIG) {
+        if (nStack != 1)
+            return STANDARD_SCRIPT_UNHANDLED;
+        if (!CheckStandardSig(stack[0], valtype(script.begin() + 1, script.end() - 1), script, flags, checker, serror))
+            return STANDARD_SCRIPT_INVALID;
+        return STANDARD_SCRIPT_VALID;
+    }
+
+    int nRequired;
+    vector<valtype> vKeys;
+    if (!MatchMultisig(script, flags, nRequired, vKeys) || nStack != (size_t)nRequired + 1)
+        return STANDARD_SCRIPT_UNHANDLED;
+    // The interpreter only looks at the dummy after the signatures
+    if ((flags & SCRIPT_VERIFY_NULLDUMMY) && !stack[0].empty())
+        return STANDARD_SCRIPT_UNHANDLED;
+
+    // Same order as OP_CHECKMULTISIG: last signature against last key, walking down
+    CScript scriptCode(script);
+    for (int k = nRequired; k > 0; k--)
+        scriptCode.FindAndDelete(CScript(stack[k]));
+    int isig = nRequired, ikey = vKeys.size() - 1;
+    while (isig > 0) {
+        if (ikey + 1 < isig) {
+            set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+            return STANDARD_SCRIPT_INVALID;
+        }
+        if (!CheckSignatureEncoding(stack[isig], flags, serror) || !CheckPubKeyEncoding(vKeys[ikey], flags, serror))
+            return STANDARD_SCRIPT_INVALID;
+        if (checker.CheckSig(stack[isig], vKeys[ikey], scriptCode))
+            isig--;
+        ikey--;
+    }
+    return STANDARD_SCRIPT_VALID;
+}
+
+} // anon namespace
+
+StandardScriptResult VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    vector<valtype> stack;
+    if (!GetScriptPushes(scriptSig, flags, stack))
+        return STANDARD_SCRIPT_UNHANDLED;
+
+    StandardScriptResult result;
+    if (scriptPubKey.IsPayToScriptHash()) {
+        if (!(flags & SCRIPT_VERIFY_P2SH) || stack.empty())
+            return STANDARD_SCRIPT_UNHANDLED;
+        const valtype& vchRedeem = stack.back();
+        unsigned char vchHash[CHash160::OUTPUT_SIZE];
+        CHash160().Write(begin_ptr(vchRedeem), vchRedeem.size()).Finalize(vchHash);
+        if (memcmp(vchHash, &scriptPubKey[2], sizeof(vchHash)) != 0) {
+            set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+            return STANDARD_SCRIPT_INVALID;
+        }
+        result = VerifyStandardTemplate(stack, stack.size() - 1, CScript(vchRedeem.begin(), vchRedeem.end()), flags, checker, serror);
+    } else {
+        result = VerifyStandardTemplate(stack, stack.size(), scriptPubKey, flags, checker, serror);
+    }
+    if (result == STANDARD_SCRIPT_VALID)
+        set_success(serror);
+    return result;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    // Anything the fast path does not recognise gets the interpreter
+    StandardScriptResult result = VerifyStandardScript(scriptSig, scriptPubKey, flags, checker, serror);
+    if (result != STANDARD_SCRIPT_UNHANDLED)
+        return result == STANDARD_SCRIPT_VALID;
+    return VerifyScriptInterpreted(scriptSig, scriptPubKey, flags, checker, serror);
+}
+
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
 {
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
 
@@ -7,6 +7,7 @@
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
 #include "script_error.h"
+#include "crypto/sha256.h"
 #include "primitives/transaction.h"
 
 #include <vector>
@@ -72,7 +73,26 @@ enum
 
 };
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * The parts of a transaction's SIGHASH_ALL signature serialization that are
+ * the same for every input, serialized once so that signing or checking each
+ * input does not re-serialize the whole transaction.
+ */
+struct PrecomputedTransactionData
+{
+    //! nVersion, the input count and every input with its script blanked
+    std::vector<unsigned char> vchInputs;
+    //! hasher state over vchInputs up to each input's (blank) script
+    std::vector<CSHA256> vPrefix;
+    //! offset of each input's blank script in vchInputs
+    std::vector<size_t> vScriptOffset;
+    //! the output count, every output and nLockTime
+    std::vector<unsigned char> vchOutputs;
+
+    PrecomputedTransactionData(const CTransaction& tx);
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* txdata = NULL);
 
 class BaseSignatureChecker
 {
@@ -90,12 +110,13 @@ class TransactionSignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction* txTo;
     unsigned int nIn;
+    const PrecomputedTransactionData* txdata;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const PrecomputedTransactionData* txdataIn = NULL) : txTo(txToIn), nIn(nInIn), txdata(txdataIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
 };
 
@@ -111,4 +132,23 @@ public:
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 
+/** Outcome of VerifyStandardScript */
+enum StandardScriptResult
+{
+    // Not a recognised template, the interpreter has to decide
+    STANDARD_SCRIPT_UNHANDLED,
+    STANDARD_SCRIPT_VALID,
+    // The interpreter fails too, with the same error
+    STANDARD_SCRIPT_INVALID,
+};
+
+/**
+ * Verify P2PK, P2PKH and bare or P2SH multisig spends by matching the templates
+ * and checking their signatures directly. A valid or invalid answer always
+ * agrees with the interpreter, including the error it reports.
+ */
+StandardScriptResult VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
+/** VerifyScript without the standard template fast path */
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
+
 #endif // BITCOIN_SCRIPT_INTERPRETER_H
@@ -238,9 +238,9 @@ bool CScript::IsPayToScriptHash() const
 {
     // Extra-fast test for pay-to-script-hash CScripts:
     return (this->size() == 23 &&
-            this->at(0) == OP_HASH160 &&
-            this->at(1) == 0x14 &&
-            this->at(22) == OP_EQUAL);
+            (*this)[0] == OP_HASH160 &&
+            (*this)[1] == 0x14 &&
+            (*this)[22] == OP_EQUAL);
 }
 
 bool CScript::IsPushOnly() const
@@ -286,5 +286,5 @@ std::string CScript::ToString() const
 
 size_t CScript::DynamicMemoryUsage() const
 {
-    return memusage::DynamicUsage(*(static_cast<const std::vector<unsigned char>*>(this)));
+    return memusage::DynamicUsage(*static_cast<const CScriptBase*>(this));
 }
@@ -10,11 +10,16 @@
 
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// DoS prevention: the cache is a fixed 40MB (about a million entries)
+// however many signatures are thrown at it.
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
 
 class CPubKey;
+struct CCuckooCacheStats;
+
+/** Allocate the signature cache at the -maxsigcachesize given; call once, before verification threads start */
+void InitSignatureCache();
+void GetSignatureCacheStats(CCuckooCacheStats& stats);
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
@@ -22,7 +27,7 @@ private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true, const PrecomputedTransactionData* txdataIn=NULL) : TransactionSignatureChecker(txToIn, nInIn, txdataIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
@@ -30,6 +30,8 @@ extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nTxSize;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
 extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
@@ -196,4 +198,56 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
 }
 
+BOOST_AUTO_TEST_CASE(DoS_mapOrphans_quota_expiry)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // A single peer flooding orphans can only ever use its own quota:
+    for (int i = 0; i < 1000; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = 0;
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vin[0].scriptSig << std::vector<unsigned char>(1000, 0x01);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1*CENT;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+
+        BOOST_CHECK(AddOrphanTx(tx, 0));
+    }
+    size_t nPeerBytes = 0;
+    for (std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+    {
+        BOOST_CHECK_EQUAL(it->second.fromPeer, 0);
+        nPeerBytes += it->second.nTxSize;
+    }
+    BOOST_CHECK(nPeerBytes <= MAX_ORPHAN_TX_PEER_BYTES);
+    BOOST_CHECK(mapOrphanTransactions.size() > 1);
+
+    // ... and another peer's orphan is not pushed out by it:
+    CMutableTransaction txOther;
+    txOther.vin.resize(1);
+    txOther.vin[0].prevout.n = 0;
+    txOther.vin[0].prevout.hash = GetRandHash();
+    txOther.vout.resize(1);
+    txOther.vout[0].nValue = 1*CENT;
+    txOther.vout[0].scriptPubKey = scriptPubKey;
+    BOOST_CHECK(AddOrphanTx(txOther, 1));
+    LimitOrphanTxSize(mapOrphanTransactions.size() - 1);
+    BOOST_CHECK(mapOrphanTransactions.count(CTransaction(txOther).GetHash()));
+
+    EraseOrphansFor(0);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 1U);
+
+    // Orphans whose parents never arrive expire:
+    SetMockTime(GetTime() + ORPHAN_TX_EXPIRE_TIME + 1);
+    LimitOrphanTxSize(DEFAULT_MAX_ORPHAN_TRANSACTIONS);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
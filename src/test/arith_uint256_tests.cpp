@@ -10,6 +10,7 @@
 #include <cmath>
 #include "uint256.h"
 #include "arith_uint256.h"
+#include "random.h"
 #include <string>
 #include "version.h"
 
@@ -368,6 +369,60 @@ BOOST_AUTO_TEST_CASE( divide )
 }
 
 
+/// Random number of random bit length, so divisions hit every limb count.
+arith_uint256 RandomArith256()
+{
+    arith_uint256 r;
+    for (int i = 0; i < 8; i++) {
+        r <<= 32;
+        r |= insecure_rand();
+    }
+    return r >> (insecure_rand() % 256);
+}
+
+/// The original bit-at-a-time shift-subtract division, as a reference.
+arith_uint256 ShiftSubtractDivide(arith_uint256 num, arith_uint256 div)
+{
+    arith_uint256 quotient;
+    int num_bits = num.bits();
+    int div_bits = div.bits();
+    if (div_bits > num_bits)
+        return quotient;
+    int shift = num_bits - div_bits;
+    div <<= shift;
+    while (shift >= 0) {
+        if (num >= div) {
+            num -= div;
+            quotient |= (arith_uint256(1) << shift);
+        }
+        div >>= 1;
+        shift--;
+    }
+    return quotient;
+}
+
+BOOST_AUTO_TEST_CASE( divide_random )
+{
+    for (int i = 0; i < 2000; i++) {
+        arith_uint256 a = RandomArith256();
+        arith_uint256 b = RandomArith256();
+        if (b == 0)
+            continue;
+        arith_uint256 q = a / b;
+        BOOST_CHECK(q == ShiftSubtractDivide(a, b));
+        BOOST_CHECK(a - q * b < b);
+        BOOST_CHECK(a / arith_uint256(b.GetLow64() | 1) == ShiftSubtractDivide(a, b.GetLow64() | 1));
+    }
+    // Divisors whose top limb needs no normalization, and quotients that
+    // need the add-back step.
+    BOOST_CHECK(MaxL / HalfL == 1);
+    BOOST_CHECK((MaxL / (HalfL + 1)) == 1);
+    arith_uint256 c = (OneL << 128) - 1;
+    BOOST_CHECK(MaxL / c == ShiftSubtractDivide(MaxL, c));
+    BOOST_CHECK((c * c) / c == c);
+    BOOST_CHECK(((c * c) + (c - 1)) / c == c);
+}
+
 bool almostEqual(double d1, double d2)
 {
     return fabs(d1-d2) <= 4*fabs(d1)*std::numeric_limits<double>::epsilon();
@@ -537,6 +592,31 @@ BOOST_AUTO_TEST_CASE(bignum_SetCompact)
 }
 
 
+BOOST_AUTO_TEST_CASE( compact_random )
+{
+    for (int i = 0; i < 2000; i++) {
+        arith_uint256 a = RandomArith256();
+        uint32_t nCompact = a.GetCompact();
+
+        // Reference: shift the number down to its top three bytes.
+        int nSize = (a.bits() + 7) / 8;
+        uint32_t nExpected = nSize <= 3 ? a.GetLow64() << 8 * (3 - nSize) : (a >> 8 * (nSize - 3)).GetLow64();
+        if (nExpected & 0x00800000) {
+            nExpected >>= 8;
+            nSize++;
+        }
+        nExpected |= nSize << 24;
+        BOOST_CHECK_EQUAL(nCompact, nExpected);
+
+        arith_uint256 b;
+        b.SetCompact(nCompact);
+        BOOST_CHECK_EQUAL(b.GetCompact(), nCompact);
+        BOOST_CHECK(b <= a);
+        if (nSize > 3)
+            BOOST_CHECK(b == ((a >> 8 * (nSize - 3)) << 8 * (nSize - 3)));
+    }
+}
+
 BOOST_AUTO_TEST_CASE( getmaxcoverage ) // some more tests just to get 100% coverage
 {
     // ~R1L give a base_uint<256>
@@ -247,4 +247,21 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int blocks = 0; blocks < 20; blocks++) {
+        std::vector<unsigned char> in(64 * blocks), out1(32 * blocks), out2(32 * blocks);
+        for (size_t i = 0; i < in.size(); i++)
+            in[i] = insecure_rand() & 0xff;
+        for (int j = 0; j < blocks; j++) {
+            unsigned char first[CSHA256::OUTPUT_SIZE];
+            CSHA256().Write(&in[64 * j], 64).Finalize(first);
+            CSHA256().Write(first, sizeof(first)).Finalize(&out1[32 * j]);
+        }
+        if (blocks)
+            SHA256D64(&out2[0], &in[0], blocks);
+        BOOST_CHECK(out1 == out2);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -23,4 +23,64 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 1350824726649000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    CBlockDownloadWindow window;
+    BOOST_CHECK_EQUAL(window.nBlocksInFlightMax, DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // 100kB blocks, each arriving 100ms after it was requested, back to back
+    int64_t nNow = 1000000000;
+    window.BlockReceived(nNow - 100000, nNow, 100000);
+    BOOST_CHECK_EQUAL(window.nBlocksInFlightMax, DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER + 1);
+    for (int i = 0; i < 2 * MAX_BLOCKS_IN_TRANSIT_PER_PEER; i++) {
+        nNow += 100000;
+        window.BlockReceived(nNow - 100000, nNow, 100000);
+    }
+    BOOST_CHECK_EQUAL(window.nBlocksInFlightMax, MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(window.nBlockLatency, 100000);
+    BOOST_CHECK_EQUAL(window.nBlockThroughput, 1000000);
+
+    // A latency jump means the peer's queue is building up
+    nNow += 300000;
+    window.BlockReceived(nNow - 300000, nNow, 100000);
+    BOOST_CHECK_EQUAL(window.nBlocksInFlightMax, MAX_BLOCKS_IN_TRANSIT_PER_PEER - 1);
+    BOOST_CHECK_EQUAL(window.nBlockLatency, 125000);
+
+    // Within twice the usual latency still counts as keeping pace
+    nNow += 250000;
+    window.BlockReceived(nNow - 250000, nNow, 100000);
+    BOOST_CHECK_EQUAL(window.nBlocksInFlightMax, MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Never below the minimum
+    window.nBlocksInFlightMax = MIN_BLOCKS_IN_TRANSIT_PER_PEER;
+    nNow += 10000000;
+    window.BlockReceived(nNow - 10000000, nNow, 100000);
+    BOOST_CHECK_EQUAL(window.nBlocksInFlightMax, MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_rerequest)
+{
+    CBlockDownloadWindow fast, slow;
+    fast.nBlockLatency = 100000;
+    slow.nBlockLatency = 1000000;
+    int64_t nNow = 1000000000;
+
+    // Only a peer with a measured latency and room in its window may take the block over
+    BOOST_CHECK(!ShouldRerequestBlock(CBlockDownloadWindow(), 0, slow, nNow - 60000000, nNow));
+    BOOST_CHECK(!ShouldRerequestBlock(fast, fast.nBlocksInFlightMax, slow, nNow - 60000000, nNow));
+
+    // Overdue means more than twice the staller's latency...
+    BOOST_CHECK(!ShouldRerequestBlock(fast, 0, slow, nNow - 2000000, nNow));
+    BOOST_CHECK(ShouldRerequestBlock(fast, 0, slow, nNow - 2000001, nNow));
+
+    // ...and more than four times our own...
+    BOOST_CHECK(!ShouldRerequestBlock(slow, 0, fast, nNow - 4000000, nNow));
+    BOOST_CHECK(ShouldRerequestBlock(slow, 0, fast, nNow - 4000001, nNow));
+
+    // ...but never less than a quarter of the stalling timeout
+    int64_t nFloor = BLOCK_STALLING_TIMEOUT * 1000000 / 4;
+    BOOST_CHECK(!ShouldRerequestBlock(fast, 0, fast, nNow - nFloor, nNow));
+    BOOST_CHECK(ShouldRerequestBlock(fast, 0, fast, nNow - nFloor - 1, nNow));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
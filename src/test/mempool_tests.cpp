@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "main.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -58,17 +60,17 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     BOOST_CHECK_EQUAL(removed.size(), 0);
 
     // Just the parent:
-    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1, 0));
     testPool.remove(txParent, removed, true);
     BOOST_CHECK_EQUAL(removed.size(), 1);
     removed.clear();
     
     // Parent, children, grandchildren:
-    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1, 0));
     for (int i = 0; i < 3; i++)
     {
-        testPool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 0, 0, 0.0, 1));
-        testPool.addUnchecked(txGrandChild[i].GetHash(), CTxMemPoolEntry(txGrandChild[i], 0, 0, 0.0, 1));
+        testPool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 0, 0, 0.0, 1, 0));
+        testPool.addUnchecked(txGrandChild[i].GetHash(), CTxMemPoolEntry(txGrandChild[i], 0, 0, 0.0, 1, 0));
     }
     // Remove Child[0], GrandChild[0] should be removed:
     testPool.remove(txChild[0], removed, true);
@@ -88,8 +90,8 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     // Add children and grandchildren, but NOT the parent (simulate the parent being in a block)
     for (int i = 0; i < 3; i++)
     {
-        testPool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 0, 0, 0.0, 1));
-        testPool.addUnchecked(txGrandChild[i].GetHash(), CTxMemPoolEntry(txGrandChild[i], 0, 0, 0.0, 1));
+        testPool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 0, 0, 0.0, 1, 0));
+        testPool.addUnchecked(txGrandChild[i].GetHash(), CTxMemPoolEntry(txGrandChild[i], 0, 0, 0.0, 1, 0));
     }
     // Now remove the parent, as might happen if a block-re-org occurs but the parent cannot be
     // put into the mempool (maybe because it is non-standard):
@@ -99,4 +101,93 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolFeeEstimateTest)
+{
+    CTxMemPool testPool(CFeeRate(1000));
+    std::list<CTransaction> dummy;
+    CFeeRate feeFast, feeSlow;
+
+    // Every block confirms ten high-fee transactions that waited one block
+    // and ten low-fee transactions that waited four blocks.
+    for (unsigned int nHeight = 101; nHeight <= 130; nHeight++)
+    {
+        std::vector<CTransaction> vtx;
+        for (int i = 0; i < 20; i++)
+        {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].scriptSig = CScript() << OP_11;
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+            tx.vout[0].nValue = nHeight * 100 + i;
+            unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            bool fFast = i < 10;
+            CAmount nFee = (fFast ? 20000 : 2000) * nSize / 1000;
+            if (fFast)
+                feeFast = CFeeRate(nFee, nSize);
+            else
+                feeSlow = CFeeRate(nFee, nSize);
+            testPool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, 0, 0.0, nHeight - (fFast ? 1 : 4), 0));
+            vtx.push_back(tx);
+        }
+        testPool.removeForBlock(vtx, nHeight, dummy);
+    }
+    BOOST_CHECK_EQUAL(testPool.size(), 0);
+
+    BOOST_CHECK_CLOSE((double)testPool.estimateFee(1).GetFeePerK(), (double)feeFast.GetFeePerK(), 0.1);
+    BOOST_CHECK_CLOSE((double)testPool.estimateFee(3).GetFeePerK(), (double)feeFast.GetFeePerK(), 0.1);
+    BOOST_CHECK_CLOSE((double)testPool.estimateFee(4).GetFeePerK(), (double)feeSlow.GetFeePerK(), 0.1);
+    BOOST_CHECK_CLOSE((double)testPool.estimateFee(25).GetFeePerK(), (double)feeSlow.GetFeePerK(), 0.1);
+    BOOST_CHECK(testPool.estimateFee(26) == CFeeRate(0));
+    BOOST_CHECK(testPool.estimatePriority(1) < 0);
+
+    // Estimates survive a round trip through the estimates file
+    CAutoFile fileout(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(testPool.WriteFeeEstimates(fileout));
+    rewind(fileout.Get());
+    CTxMemPool readPool(CFeeRate(1000));
+    BOOST_CHECK(readPool.ReadFeeEstimates(fileout));
+    for (int i = 1; i <= 25; i++)
+        BOOST_CHECK(readPool.estimateFee(i) == testPool.estimateFee(i));
+
+    // Files in the old sample format are ignored
+    CAutoFile fileold(tmpfile(), SER_DISK, CLIENT_VERSION);
+    fileold << 120000 << CLIENT_VERSION << 130 << (size_t)25;
+    rewind(fileold.Get());
+    CTxMemPool oldPool(CFeeRate(1000));
+    BOOST_CHECK(!oldPool.ReadFeeEstimates(fileold));
+    BOOST_CHECK(oldPool.estimateFee(1) == CFeeRate(0));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolEntryMetadataTest)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = CScript() << OP_CHECKSIG;
+    tx.vout[0].nValue = 10000LL;
+    tx.vout[1].scriptPubKey = CScript() << OP_1 << OP_CHECKMULTISIG;
+    tx.vout[1].nValue = 10000LL;
+    uint256 hash = tx.GetHash();
+
+    // Legacy sigops come from the transaction, P2SH ones from the caller
+    CTxMemPoolEntry entry(tx, 1000, 0, 0.0, 1, 5);
+    BOOST_CHECK_EQUAL(entry.GetSigOpCount(), 1 + 20 + 5);
+    BOOST_CHECK_EQUAL(entry.GetTxSize(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+
+    // Deltas set before the transaction arrives are picked up on entry...
+    CTxMemPool testPool(CFeeRate(0));
+    testPool.PrioritiseTransaction(hash, hash.ToString(), 10.0, 500);
+    testPool.addUnchecked(hash, entry);
+    BOOST_CHECK_EQUAL(testPool.mapTx[hash].GetModifiedFee(), 1500);
+    BOOST_CHECK_EQUAL(testPool.mapTx[hash].GetPriorityDelta(), 10.0);
+
+    // ... and later ones update the pool entry in place
+    testPool.PrioritiseTransaction(hash, hash.ToString(), 0.0, -2000);
+    BOOST_CHECK_EQUAL(testPool.mapTx[hash].GetFeeDelta(), -1500);
+    BOOST_CHECK_EQUAL(testPool.mapTx[hash].GetModifiedFee(), -500);
+    BOOST_CHECK_EQUAL(testPool.mapTx[hash].GetFee(), 1000);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,300 @@
+// Copyright (c) 2015 The Terracoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+
+#include "chainparams.h"
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "protocol.h"
+
+#include <zlib.h>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+BOOST_AUTO_TEST_CASE(net_shared_message)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    CSerializeDataRef msg = CNode::MakeMessage("tx", CTransaction(tx));
+    BOOST_REQUIRE(msg);
+
+    // The header must describe the payload exactly as EndMessage would
+    CDataStream ss(msg->begin(), msg->end(), SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr(Params().MessageStart());
+    ss >> hdr;
+    BOOST_CHECK(hdr.IsValid(Params().MessageStart()));
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "tx");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, ss.size());
+    uint256 hash = Hash(ss.begin(), ss.end());
+    BOOST_CHECK_EQUAL(hdr.nChecksum, ReadLE32(hash.begin()));
+
+    CTransaction txOut;
+    ss >> txOut;
+    BOOST_CHECK(txOut.GetHash() == tx.GetHash());
+    BOOST_CHECK(ss.empty());
+}
+
+BOOST_AUTO_TEST_CASE(net_message_cache)
+{
+    CInv inv(MSG_TX, GetRandHash());
+    BOOST_CHECK(!GetCachedMessage(inv));
+
+    CSerializeDataRef msg = CNode::MakeMessage("tx", CTransaction());
+    CacheMessage(inv, msg);
+    BOOST_CHECK(GetCachedMessage(inv) == msg);
+
+    // Fill the cache past its budget, the oldest entry goes first and
+    // references held elsewhere stay valid
+    boost::shared_ptr<CSerializeData> big(new CSerializeData(MAX_MESSAGE_CACHE_SIZE / 2));
+    CInv invBig1(MSG_BLOCK, GetRandHash()), invBig2(MSG_BLOCK, GetRandHash());
+    CacheMessage(invBig1, big);
+    CacheMessage(invBig2, big);
+    BOOST_CHECK(!GetCachedMessage(inv));
+    BOOST_CHECK(GetCachedMessage(invBig1) == big);
+    BOOST_CHECK(GetCachedMessage(invBig2) == big);
+    BOOST_CHECK(msg->size() > CMessageHeader::HEADER_SIZE);
+
+    // Oversized messages are not kept at all
+    boost::shared_ptr<CSerializeData> huge(new CSerializeData(MAX_MESSAGE_CACHE_SIZE + 1));
+    CInv invHuge(MSG_BLOCK, GetRandHash());
+    CacheMessage(invHuge, huge);
+    BOOST_CHECK(!GetCachedMessage(invHuge));
+    BOOST_CHECK(GetCachedMessage(invBig2) == big);
+}
+
+BOOST_AUTO_TEST_CASE(net_relay_memory)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    CTransaction tx1(tx);
+    CSerializeDataRef msg1 = CNode::MakeMessage("tx", tx1);
+    RelayTransaction(tx1, msg1);
+    RelayTransaction(tx1, CNode::MakeMessage("tx", tx1));
+    {
+        // The first message is kept and shared, not copied
+        LOCK(cs_mapRelay);
+        std::map<CInv, CSerializeDataRef>::iterator it = mapRelay.find(CInv(MSG_TX, tx1.GetHash()));
+        BOOST_REQUIRE(it != mapRelay.end());
+        BOOST_CHECK(it->second == msg1);
+    }
+
+    // Going over the memory budget pushes out the oldest messages
+    boost::shared_ptr<CSerializeData> big(new CSerializeData(MAX_RELAY_MEMORY / 2));
+    tx.nLockTime = 1;
+    CTransaction tx2(tx);
+    RelayTransaction(tx2, big);
+    tx.nLockTime = 2;
+    CTransaction tx3(tx);
+    RelayTransaction(tx3, big);
+    {
+        LOCK(cs_mapRelay);
+        BOOST_CHECK(!mapRelay.count(CInv(MSG_TX, tx1.GetHash())));
+        BOOST_CHECK(mapRelay.count(CInv(MSG_TX, tx2.GetHash())));
+        BOOST_CHECK(mapRelay.count(CInv(MSG_TX, tx3.GetHash())));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(net_message_batch)
+{
+    CAddress addr(CService("127.0.0.1", 0));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    uint256 hash1 = GetRandHash(), hash2 = GetRandHash();
+
+    node.nVersion = BATCH_VERSION;
+    {
+        CMessageBatch batch(&node);
+        batch.PushMessage("mnp", hash1);
+        batch.PushMessage("mvote", hash2);
+    }
+    BOOST_REQUIRE_EQUAL(node.vSendMsg.size(), 1U);
+    CDataStream ss(node.vSendMsg[0]->begin(), node.vSendMsg[0]->end(), SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr(Params().MessageStart());
+    ss >> hdr;
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "batch");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, ss.size());
+
+    // Random payloads do not deflate, so the entries are sent as they are: each
+    // message is packed as its command and length-prefixed payload, in order
+    unsigned char nFormat;
+    ss >> nFormat;
+    BOOST_CHECK_EQUAL(nFormat, BATCH_PLAIN);
+    string strCommand;
+    vector<unsigned char> vPayload;
+    ss >> strCommand >> vPayload;
+    BOOST_CHECK_EQUAL(strCommand, "mnp");
+    BOOST_CHECK(vPayload == vector<unsigned char>(hash1.begin(), hash1.end()));
+    ss >> strCommand >> vPayload;
+    BOOST_CHECK_EQUAL(strCommand, "mvote");
+    BOOST_CHECK(vPayload == vector<unsigned char>(hash2.begin(), hash2.end()));
+    BOOST_CHECK(ss.empty());
+
+    // Older peers get the messages one by one
+    node.vSendMsg.clear();
+    node.nVersion = BATCH_VERSION - 1;
+    {
+        CMessageBatch batch(&node);
+        batch.PushMessage("mnp", hash1);
+        batch.PushMessage("mvote", hash2);
+    }
+    BOOST_CHECK_EQUAL(node.vSendMsg.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(net_message_batch_compressed)
+{
+    CAddress addr(CService("127.0.0.1", 0));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    uint256 hash = GetRandHash();
+
+    // Repeated items deflate, and unpack to the same entries
+    node.nVersion = BATCH_VERSION;
+    {
+        CMessageBatch batch(&node);
+        for (int i = 0; i < 100; i++)
+            batch.PushMessage("mvote", hash);
+    }
+    BOOST_REQUIRE_EQUAL(node.vSendMsg.size(), 1U);
+    CDataStream ss(node.vSendMsg[0]->begin(), node.vSendMsg[0]->end(), SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr(Params().MessageStart());
+    ss >> hdr;
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "batch");
+    BOOST_CHECK_EQUAL(ss[0], (char)BATCH_ZLIB);
+    BOOST_CHECK(ss.size() < 100 * 32U);
+
+    CDataStream ssEntries(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_REQUIRE(CMessageBatch::Unpack(ss, ssEntries));
+    for (int i = 0; i < 100; i++) {
+        string strCommand;
+        vector<unsigned char> vPayload;
+        ssEntries >> strCommand >> vPayload;
+        BOOST_CHECK_EQUAL(strCommand, "mvote");
+        BOOST_CHECK(vPayload == vector<unsigned char>(hash.begin(), hash.end()));
+    }
+    BOOST_CHECK(ssEntries.empty());
+
+    // Unknown formats, corrupt streams and envelopes that inflate too far are rejected
+    CDataStream ssUnknown(SER_NETWORK, PROTOCOL_VERSION);
+    ssUnknown << (unsigned char)2 << hash;
+    BOOST_CHECK(!CMessageBatch::Unpack(ssUnknown, ssEntries));
+
+    CDataStream ssCorrupt(SER_NETWORK, PROTOCOL_VERSION);
+    ssCorrupt << (unsigned char)BATCH_ZLIB << hash;
+    BOOST_CHECK(!CMessageBatch::Unpack(ssCorrupt, ssEntries));
+
+    vector<unsigned char> vZeros(MAX_BATCH_INFLATED_SIZE + 1);
+    vector<unsigned char> vDeflated(compressBound(vZeros.size()));
+    uLongf nDeflated = vDeflated.size();
+    BOOST_REQUIRE_EQUAL(compress2(&vDeflated[0], &nDeflated, &vZeros[0], vZeros.size(), Z_BEST_SPEED), Z_OK);
+    CDataStream ssBomb(SER_NETWORK, PROTOCOL_VERSION);
+    ssBomb << (unsigned char)BATCH_ZLIB;
+    ssBomb.write((const char*)&vDeflated[0], nDeflated);
+    ssEntries.clear();
+    BOOST_CHECK(!CMessageBatch::Unpack(ssBomb, ssEntries));
+}
+
+BOOST_AUTO_TEST_CASE(net_receive_message)
+{
+    CAddress addr(CService("127.0.0.1", 0));
+    CNode node(INVALID_SOCKET, addr, "", true);
+
+    CMutableTransaction tx;
+    tx.vin.resize(3);
+    tx.vout.resize(2);
+    CSerializeDataRef msg = CNode::MakeMessage("tx", CTransaction(tx));
+    unsigned int nPayload = msg->size() - CMessageHeader::HEADER_SIZE;
+
+    // Feed the message in uneven pieces, splitting the header as well
+    const char* pch = &(*msg)[0];
+    unsigned int nPos = 0;
+    unsigned int nStep = 1;
+    while (nPos < msg->size()) {
+        unsigned int nBytes = std::min(nStep, (unsigned int)msg->size() - nPos);
+        BOOST_REQUIRE(node.ReceiveMsgBytes(pch + nPos, nBytes));
+        nPos += nBytes;
+        nStep += 7;
+    }
+
+    BOOST_REQUIRE_EQUAL(node.vRecvMsg.size(), 1U);
+    CNetMessage& recv = node.vRecvMsg.front();
+    BOOST_CHECK(recv.complete());
+    BOOST_CHECK_EQUAL(recv.hdr.GetCommand(), "tx");
+    BOOST_CHECK_EQUAL(recv.vRecv.size(), nPayload);
+    BOOST_CHECK(std::equal(recv.vRecv.begin(), recv.vRecv.end(), msg->begin() + CMessageHeader::HEADER_SIZE));
+
+    // The incrementally computed checksum matches a hash over the whole payload
+    uint256 hash = Hash(msg->begin() + CMessageHeader::HEADER_SIZE, msg->end());
+    BOOST_CHECK(recv.GetMessageHash() == hash);
+    BOOST_CHECK_EQUAL(recv.hdr.nChecksum, ReadLE32(hash.begin()));
+
+    const char* pchBuffer = &recv.vRecv[0];
+    CTransaction txOut;
+    recv.vRecv >> txOut;
+    BOOST_CHECK(txOut.GetHash() == tx.GetHash());
+
+    // A finished message hands its buffer to the next one of the same size class
+    node.vRecvMsg.clear();
+    BOOST_REQUIRE(node.ReceiveMsgBytes(pch, msg->size()));
+    BOOST_REQUIRE_EQUAL(node.vRecvMsg.size(), 1U);
+    BOOST_CHECK(node.vRecvMsg.front().complete());
+    BOOST_CHECK(&node.vRecvMsg.front().vRecv[0] == pchBuffer);
+
+    // Both messages are accounted to their command
+    CNodeStats stats;
+    node.copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.mapRecvPerMsgCmd.size(), 1U);
+    BOOST_CHECK_EQUAL(stats.mapRecvPerMsgCmd["tx"].nMessages, 2U);
+    BOOST_CHECK_EQUAL(stats.mapRecvPerMsgCmd["tx"].nBytes, 2 * msg->size());
+}
+
+BOOST_AUTO_TEST_CASE(net_upload_limiter)
+{
+    CUploadLimiter limiter;
+    int64_t nNow = 1000000;
+
+    // Unlimited until a rate is set
+    BOOST_CHECK(!limiter.IsLimited());
+    limiter.Consume(1000000, nNow);
+    BOOST_CHECK(limiter.Allow(UPLOAD_THRONE_LIST, nNow));
+
+    // 1000 bytes per second, the bucket starts with a full burst
+    limiter.SetRate(1000, nNow);
+    BOOST_CHECK(limiter.IsLimited());
+    BOOST_CHECK(limiter.Allow(UPLOAD_THRONE_LIST, nNow));
+    limiter.Consume(UPLOAD_BURST_SECONDS * 1000 - 1500, nNow);
+    BOOST_CHECK(!limiter.Allow(UPLOAD_THRONE_LIST, nNow));
+    BOOST_CHECK(limiter.Allow(UPLOAD_HISTORICAL_BLOCK, nNow));
+    limiter.Consume(1000, nNow);
+    BOOST_CHECK(!limiter.Allow(UPLOAD_HISTORICAL_BLOCK, nNow));
+    BOOST_CHECK(limiter.Allow(UPLOAD_BLOCK_RELAY, nNow));
+
+    // Relay traffic runs the bucket into debt, which the lower classes wait out
+    limiter.Consume(1000000, nNow);
+    nNow += UPLOAD_BURST_SECONDS * 1000000;
+    BOOST_CHECK(!limiter.Allow(UPLOAD_HISTORICAL_BLOCK, nNow));
+    nNow += UPLOAD_BURST_SECONDS * 1000000 / 4;
+    BOOST_CHECK(limiter.Allow(UPLOAD_HISTORICAL_BLOCK, nNow));
+    BOOST_CHECK(!limiter.Allow(UPLOAD_THRONE_LIST, nNow));
+
+    // Tokens keep coming in when asked for more often than one per interval
+    for (int i = 0; i < 1000 * UPLOAD_BURST_SECONDS / 4; i++) {
+        nNow += 999;
+        limiter.Allow(UPLOAD_THRONE_LIST, nNow);
+    }
+    nNow += 1000;
+    BOOST_CHECK(limiter.Allow(UPLOAD_THRONE_LIST, nNow));
+
+    // The bucket holds no more than one burst
+    nNow += 3600 * 1000000LL;
+    limiter.Consume(UPLOAD_BURST_SECONDS * 1000 / 2 + 1, nNow);
+    BOOST_CHECK(!limiter.Allow(UPLOAD_THRONE_LIST, nNow));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "netbase.h"
+#include "utiltime.h"
 
 #include <string>
 
@@ -145,4 +146,62 @@ BOOST_AUTO_TEST_CASE(subnet_test)
     BOOST_CHECK(!CSubNet("fuzzy").IsValid());
 }
 
+static SOCKET BindLocal(CService& addrRet, bool fListen)
+{
+    SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in sockaddr;
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    BOOST_REQUIRE(bind(hSocket, (struct sockaddr*)&sockaddr, sizeof(sockaddr)) != SOCKET_ERROR);
+    if (fListen)
+        BOOST_REQUIRE(listen(hSocket, 8) != SOCKET_ERROR);
+    socklen_t len = sizeof(sockaddr);
+    getsockname(hSocket, (struct sockaddr*)&sockaddr, &len);
+    BOOST_REQUIRE(addrRet.SetSockAddr((const struct sockaddr*)&sockaddr));
+    return hSocket;
+}
+
+BOOST_AUTO_TEST_CASE(netbase_connect_parallel)
+{
+    CService addrClosed, addrOpen;
+    SOCKET hClosed = BindLocal(addrClosed, false);
+    CloseSocket(hClosed); // nothing listens there any more
+    SOCKET hListen = BindLocal(addrOpen, true);
+
+    vector<CService> vAddr;
+    vAddr.push_back(addrClosed);
+    vAddr.push_back(addrOpen);
+    vAddr.push_back(addrOpen);
+    vector<SOCKET> vSocket;
+    vector<bool> vFailed;
+
+    // The refused candidate hands over to the next one without waiting out
+    // the stagger, and the third is never needed
+    int64_t nStart = GetTimeMillis();
+    BOOST_CHECK_EQUAL(ConnectSocketsParallel(vAddr, vSocket, vFailed, 1, 5000, 10000), 2U);
+    BOOST_CHECK(GetTimeMillis() - nStart < 5000);
+    BOOST_REQUIRE_EQUAL(vSocket.size(), 3U);
+    BOOST_REQUIRE_EQUAL(vFailed.size(), 3U);
+    BOOST_CHECK(vSocket[0] == INVALID_SOCKET && vFailed[0]);
+    BOOST_CHECK(vSocket[1] != INVALID_SOCKET && !vFailed[1]);
+    BOOST_CHECK(vSocket[2] == INVALID_SOCKET && !vFailed[2]);
+    CloseSocket(vSocket[1]);
+
+    // Enough room for both open candidates
+    vAddr.erase(vAddr.begin());
+    BOOST_CHECK_EQUAL(ConnectSocketsParallel(vAddr, vSocket, vFailed, 2, 5000, 0), 2U);
+    BOOST_CHECK(vSocket[0] != INVALID_SOCKET && vSocket[1] != INVALID_SOCKET);
+    CloseSocket(vSocket[0]);
+    CloseSocket(vSocket[1]);
+
+    // Room for one: whichever loses the race is dropped, not marked as failed
+    ConnectSocketsParallel(vAddr, vSocket, vFailed, 1, 5000, 0);
+    BOOST_CHECK((vSocket[0] != INVALID_SOCKET) != (vSocket[1] != INVALID_SOCKET));
+    BOOST_CHECK(!vFailed[0] && !vFailed[1]);
+    CloseSocket(vSocket[0]);
+    CloseSocket(vSocket[1]);
+    CloseSocket(hListen);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
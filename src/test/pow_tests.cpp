@@ -0,0 +1,87 @@
+// Copyright (c) 2015 The Terracoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(pow_tests)
+
+/** DarkGravityWave v3 written out directly, without any caching. */
+static unsigned int ReferenceDarkGravityWave(const CBlockIndex* pindexLast)
+{
+    arith_uint256 bnAverage;
+    int64_t nActualTimespan = pindexLast->GetBlockTime();
+    const CBlockIndex* pindex = pindexLast;
+    int64_t nCount = 0;
+    for (; nCount < 24; nCount++) {
+        arith_uint256 bnTarget;
+        bnTarget.SetCompact(pindex->nBits);
+        if (nCount == 0)
+            bnAverage = bnTarget;
+        else
+            bnAverage = (bnAverage * (nCount + 1) + bnTarget) / (nCount + 2);
+        nActualTimespan = pindexLast->GetBlockTime() - pindex->GetBlockTime();
+        if (pindex->pprev == NULL) {
+            nCount++;
+            break;
+        }
+        pindex = pindex->pprev;
+    }
+
+    int64_t nTargetTimespan = nCount * Params().TargetSpacing();
+    nActualTimespan = std::max(nActualTimespan, nTargetTimespan / 3);
+    nActualTimespan = std::min(nActualTimespan, nTargetTimespan * 3);
+
+    arith_uint256 bnNew = bnAverage * nActualTimespan / nTargetTimespan;
+    if (bnNew > Params().ProofOfWorkLimit())
+        bnNew = Params().ProofOfWorkLimit();
+    return bnNew.GetCompact();
+}
+
+BOOST_AUTO_TEST_CASE(dgw_cached)
+{
+    // Heights past the DarkGravityWave switch; nothing below the first
+    // block is needed since the walk stops at a missing pprev.
+    const int nBlocks = 40;
+    std::vector<CBlockIndex> blocks(nBlocks + 1);
+    std::vector<uint256> hashes(nBlocks + 1);
+    for (int i = 0; i < nBlocks + 1; i++) {
+        hashes[i] = GetRandHash();
+        blocks[i].phashBlock = &hashes[i];
+        blocks[i].nHeight = 840000 + i;
+        blocks[i].nTime = 1500000000 + i * Params().TargetSpacing() + (int)(insecure_rand() % 600) - 300;
+        blocks[i].nBits = arith_uint256(UintToArith256(GetRandHash()) >> 40).GetCompact();
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+    }
+    // The last block competes with block nBlocks - 1 for the same parent.
+    blocks[nBlocks].pprev = &blocks[nBlocks - 2];
+    blocks[nBlocks].nHeight = blocks[nBlocks - 1].nHeight;
+
+    int nChanged = 0;
+    for (int i = 0; i < nBlocks + 1; i++) {
+        unsigned int nExpected = ReferenceDarkGravityWave(&blocks[i]);
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[i], NULL), nExpected);
+
+        // Once cached, the answer no longer looks at the blocks themselves,
+        // so changing one behind the cache's back goes unnoticed
+        unsigned int nBitsOld = blocks[i].nBits;
+        blocks[i].nBits = 0x1b0404cb;
+        if (ReferenceDarkGravityWave(&blocks[i]) != nExpected)
+            nChanged++;
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[i], NULL), nExpected);
+        blocks[i].nBits = nBitsOld;
+    }
+    // Most of those changes move the real target, or the check above proves nothing
+    BOOST_CHECK(nChanged > nBlocks / 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+// Copyright (c) 2015 The Terracoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "prevector.h"
+#include "random.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "streams.h"
+#include "version.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(prevector_tests)
+
+template<unsigned int N, typename T>
+class prevector_tester {
+    typedef std::vector<T> realtype;
+    realtype real_vector;
+
+    typedef prevector<N, T> pretype;
+    pretype pre_vector;
+
+public:
+    void check()
+    {
+        BOOST_REQUIRE_EQUAL(real_vector.size(), pre_vector.size());
+        BOOST_CHECK_EQUAL(real_vector.empty(), pre_vector.empty());
+        for (size_t s = 0; s < real_vector.size(); s++)
+            BOOST_CHECK(real_vector[s] == pre_vector[s]);
+        BOOST_CHECK(pre_vector.capacity() >= pre_vector.size());
+
+        // Copies compare equal and serialize exactly like the vector
+        pretype pre_copy(pre_vector);
+        BOOST_CHECK(pre_copy == pre_vector);
+        pretype pre_range(real_vector.begin(), real_vector.end());
+        BOOST_CHECK(pre_range == pre_vector);
+        CDataStream ss1(SER_DISK, PROTOCOL_VERSION), ss2(SER_DISK, PROTOCOL_VERSION);
+        ss1 << real_vector;
+        ss2 << pre_vector;
+        BOOST_CHECK(ss1.str() == ss2.str());
+        pretype pre_read;
+        ss2 >> pre_read;
+        BOOST_CHECK(pre_read == pre_vector);
+    }
+
+    void resize(size_t s) { real_vector.resize(s); pre_vector.resize(s); }
+    void insert(size_t pos, const T& value) { real_vector.insert(real_vector.begin() + pos, value); pre_vector.insert(pre_vector.begin() + pos, value); }
+    void insert(size_t pos, size_t count, const T& value) { real_vector.insert(real_vector.begin() + pos, count, value); pre_vector.insert(pre_vector.begin() + pos, count, value); }
+    void insert_range(size_t pos, const std::vector<T>& values) { real_vector.insert(real_vector.begin() + pos, values.begin(), values.end()); pre_vector.insert(pre_vector.begin() + pos, values.begin(), values.end()); }
+    void erase(size_t first, size_t last) { real_vector.erase(real_vector.begin() + first, real_vector.begin() + last); pre_vector.erase(pre_vector.begin() + first, pre_vector.begin() + last); }
+    void update(size_t pos, const T& value) { real_vector[pos] = value; pre_vector[pos] = value; }
+    void push_back(const T& value) { real_vector.push_back(value); pre_vector.push_back(value); }
+    void pop_back() { real_vector.pop_back(); pre_vector.pop_back(); }
+    void clear() { real_vector.clear(); pre_vector.clear(); }
+    void shrink_to_fit() { pre_vector.shrink_to_fit(); }
+    void swap() { pretype other(real_vector.begin(), real_vector.end()); pre_vector.swap(other); BOOST_CHECK(other == pre_vector); }
+    size_t size() const { return real_vector.size(); }
+};
+
+BOOST_AUTO_TEST_CASE(prevector_random_ops)
+{
+    for (int j = 0; j < 64; j++) {
+        prevector_tester<8, unsigned char> test;
+        for (int i = 0; i < 512; i++) {
+            int r = insecure_rand();
+            if ((r % 4) == 0)
+                test.insert(insecure_rand() % (test.size() + 1), insecure_rand());
+            if (test.size() > 0 && ((r >> 2) % 4) == 1)
+                test.erase(insecure_rand() % test.size(), test.size());
+            if (((r >> 4) % 8) == 2)
+                test.resize(std::max(0, std::min(30, (int)test.size() + (int)(insecure_rand() % 5) - 2)));
+            if (((r >> 7) % 8) == 3)
+                test.insert(insecure_rand() % (test.size() + 1), 1 + (insecure_rand() % 2), insecure_rand());
+            if (((r >> 10) % 8) == 4) {
+                std::vector<unsigned char> values(insecure_rand() % 12, insecure_rand());
+                test.insert_range(insecure_rand() % (test.size() + 1), values);
+            }
+            if (test.size() > 0 && ((r >> 13) % 16) == 5)
+                test.update(insecure_rand() % test.size(), insecure_rand());
+            if (((r >> 17) % 4) == 1)
+                test.push_back(insecure_rand());
+            if (test.size() > 0 && ((r >> 19) % 8) == 3)
+                test.pop_back();
+            if (((r >> 22) % 16) == 6)
+                test.shrink_to_fit();
+            if (((r >> 26) % 32) == 7)
+                test.swap();
+            if (((r >> 29) % 8) == 0 && test.size() > 40)
+                test.clear();
+            test.check();
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(prevector_script_inline)
+{
+    // Standard output scripts stay in the inline buffer, longer ones spill to the heap
+    CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK_EQUAL(p2pkh.size(), 25U);
+    BOOST_CHECK_EQUAL(p2pkh.DynamicMemoryUsage(), 0U);
+    CScript p2pk = CScript() << std::vector<unsigned char>(33, 2) << OP_CHECKSIG;
+    BOOST_CHECK(p2pk.DynamicMemoryUsage() > 0);
+    p2pk.clear();
+    BOOST_CHECK_EQUAL(p2pk.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -102,6 +102,16 @@ void DoTest(const CScript& scriptPubKey, const CScript& scriptSig, int flags, bo
     CMutableTransaction tx2 = tx;
     BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0), &err) == expect, message);
     BOOST_CHECK_MESSAGE(expect == (err == SCRIPT_ERR_OK), std::string(ScriptErrorString(err)) + ": " + message);
+    // The standard template fast path may never change the interpreter's verdict
+    ScriptError errInterpreted;
+    bool fInterpreted = VerifyScriptInterpreted(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0), &errInterpreted);
+    BOOST_CHECK_MESSAGE(err == errInterpreted, std::string(ScriptErrorString(errInterpreted)) + ": " + message);
+    ScriptError errStandard;
+    StandardScriptResult standard = VerifyStandardScript(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0), &errStandard);
+    if (standard != STANDARD_SCRIPT_UNHANDLED) {
+        BOOST_CHECK_MESSAGE(fInterpreted == (standard == STANDARD_SCRIPT_VALID), message);
+        BOOST_CHECK_MESSAGE(errStandard == errInterpreted, std::string(ScriptErrorString(errStandard)) + ": " + message);
+    }
 #if defined(HAVE_CONSENSUS_LIB)
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << tx2;
@@ -270,7 +280,7 @@ public:
 
     TestBuilder& PushRedeem()
     {
-        DoPush(static_cast<std::vector<unsigned char> >(scriptPubKey));
+        DoPush(ToByteVector(scriptPubKey));
         return *this;
     }
 
@@ -830,6 +840,65 @@ BOOST_AUTO_TEST_CASE(script_CHECKMULTISIG23)
     BOOST_CHECK_MESSAGE(err == SCRIPT_ERR_INVALID_STACK_OPERATION, ScriptErrorString(err));
 }    
 
+BOOST_AUTO_TEST_CASE(script_standard_fast_path)
+{
+    unsigned int standardflags = flags | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_NULLDUMMY | SCRIPT_VERIFY_MINIMALDATA;
+    CKey key1, key2, key3;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    key3.MakeNewKey(true);
+
+    // P2PKH
+    CScript scriptPubKey = GetScriptForDestination(key1.GetPubKey().GetID());
+    CMutableTransaction txFrom = BuildCreditingTransaction(scriptPubKey);
+    CMutableTransaction txTo = BuildSpendingTransaction(CScript(), txFrom);
+    uint256 hash = SignatureHash(scriptPubKey, txTo, 0, SIGHASH_ALL);
+    vector<unsigned char> vchSig;
+    BOOST_CHECK(key1.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    CScript scriptSig = CScript() << vchSig << ToByteVector(key1.GetPubKey());
+    ScriptError err;
+    BOOST_CHECK(VerifyStandardScript(scriptSig, scriptPubKey, standardflags, MutableTransactionSignatureChecker(&txTo, 0)) == STANDARD_SCRIPT_VALID);
+    BOOST_CHECK(VerifyStandardScript(CScript() << vchSig << ToByteVector(key3.GetPubKey()), scriptPubKey, standardflags, MutableTransactionSignatureChecker(&txTo, 0), &err) == STANDARD_SCRIPT_INVALID);
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_EQUALVERIFY);
+    BOOST_CHECK(VerifyStandardScript((CScript() << OP_0) + scriptSig, scriptPubKey, standardflags, MutableTransactionSignatureChecker(&txTo, 0)) == STANDARD_SCRIPT_UNHANDLED);
+
+    // P2PK
+    scriptPubKey = CScript() << ToByteVector(key2.GetPubKey()) << OP_CHECKSIG;
+    txFrom = BuildCreditingTransaction(scriptPubKey);
+    txTo = BuildSpendingTransaction(CScript(), txFrom);
+    hash = SignatureHash(scriptPubKey, txTo, 0, SIGHASH_ALL);
+    BOOST_CHECK(key2.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    BOOST_CHECK(VerifyStandardScript(CScript() << vchSig, scriptPubKey, standardflags, MutableTransactionSignatureChecker(&txTo, 0)) == STANDARD_SCRIPT_VALID);
+
+    // Bare 2-of-3 multisig: signatures must follow key order and the dummy must be empty
+    CScript scriptMulti = CScript() << OP_2 << ToByteVector(key1.GetPubKey()) << ToByteVector(key2.GetPubKey()) << ToByteVector(key3.GetPubKey()) << OP_3 << OP_CHECKMULTISIG;
+    txFrom = BuildCreditingTransaction(scriptMulti);
+    CTransaction txMulti = BuildSpendingTransaction(CScript(), txFrom);
+    std::vector<CKey> keys;
+    keys.push_back(key1); keys.push_back(key3);
+    scriptSig = sign_multisig(scriptMulti, keys, txMulti);
+    BOOST_CHECK(VerifyStandardScript(scriptSig, scriptMulti, standardflags, TransactionSignatureChecker(&txMulti, 0)) == STANDARD_SCRIPT_VALID);
+    keys.clear();
+    keys.push_back(key3); keys.push_back(key1);
+    CScript scriptSigBad = sign_multisig(scriptMulti, keys, txMulti);
+    BOOST_CHECK(VerifyStandardScript(scriptSigBad, scriptMulti, standardflags, TransactionSignatureChecker(&txMulti, 0), &err) == STANDARD_SCRIPT_INVALID);
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_EVAL_FALSE);
+    BOOST_CHECK(!VerifyScript(scriptSigBad, scriptMulti, standardflags, TransactionSignatureChecker(&txMulti, 0)));
+
+    // The same multisig behind P2SH
+    scriptPubKey = GetScriptForDestination(CScriptID(scriptMulti));
+    txFrom = BuildCreditingTransaction(scriptPubKey);
+    txMulti = BuildSpendingTransaction(CScript(), txFrom);
+    keys.clear();
+    keys.push_back(key2); keys.push_back(key3);
+    scriptSig = sign_multisig(scriptMulti, keys, txMulti) << ToByteVector(scriptMulti);
+    BOOST_CHECK(VerifyStandardScript(scriptSig, scriptPubKey, standardflags, TransactionSignatureChecker(&txMulti, 0)) == STANDARD_SCRIPT_VALID);
+    BOOST_CHECK(VerifyScriptInterpreted(scriptSig, scriptPubKey, standardflags, TransactionSignatureChecker(&txMulti, 0)));
+    BOOST_CHECK(VerifyStandardScript(scriptSig, scriptPubKey, standardflags & ~SCRIPT_VERIFY_P2SH, TransactionSignatureChecker(&txMulti, 0)) == STANDARD_SCRIPT_UNHANDLED);
+}
+
 BOOST_AUTO_TEST_CASE(script_combineSigs)
 {
     // Test the CombineSignatures function
@@ -880,7 +949,7 @@ BOOST_AUTO_TEST_CASE(script_combineSigs)
     combined = CombineSignatures(scriptPubKey, txTo, 0, scriptSigCopy, scriptSig);
     BOOST_CHECK(combined == scriptSigCopy || combined == scriptSig);
     // dummy scriptSigCopy with placeholder, should always choose non-placeholder:
-    scriptSigCopy = CScript() << OP_0 << static_cast<vector<unsigned char> >(pkSingle);
+    scriptSigCopy = CScript() << OP_0 << ToByteVector(pkSingle);
     combined = CombineSignatures(scriptPubKey, txTo, 0, scriptSigCopy, scriptSig);
     BOOST_CHECK(combined == scriptSig);
     combined = CombineSignatures(scriptPubKey, txTo, 0, scriptSig, scriptSigCopy);
@@ -0,0 +1,79 @@
+// Copyright (c) 2015 The Terracoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "darksend.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sigcache.h"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_hits)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig;
+    BOOST_REQUIRE(key.Sign(hash, vchSig));
+
+    CTransaction tx;
+    CachingTransactionSignatureChecker checker(&tx, 0, true);
+    CachingTransactionSignatureChecker checkerNoStore(&tx, 0, false);
+    CCuckooCacheStats before, after;
+    GetSignatureCacheStats(before);
+    BOOST_CHECK(before.nSlots > 0);
+
+    // Checking without storing leaves nothing behind
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+    // First check misses and stores, the second one hits
+    BOOST_CHECK(checker.VerifySignature(vchSig, pubkey, hash));
+    BOOST_CHECK(checker.VerifySignature(vchSig, pubkey, hash));
+    // A hit while not storing takes the entry out again
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+    // Invalid signatures are never cached
+    BOOST_CHECK(!checker.VerifySignature(vchSig, pubkey, GetRandHash()));
+
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nHits - before.nHits, 2U);
+    BOOST_CHECK_EQUAL(after.nMisses - before.nMisses, 4U);
+    BOOST_CHECK_EQUAL(after.nInserts - before.nInserts, 1U);
+    // The cache never grows past what was allocated at startup
+    BOOST_CHECK_EQUAL(after.nBytes, before.nBytes);
+}
+
+BOOST_AUTO_TEST_CASE(darksend_message_cache)
+{
+    CDarkSendSigner signer;
+    signer.InitCache(1 << 16);
+
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    std::string strMessage = "throne ping", strError;
+    vector<unsigned char> vchSig;
+    BOOST_REQUIRE(signer.SignMessage(strMessage, strError, vchSig, key));
+
+    CCuckooCacheStats before, after;
+    signer.GetCacheStats(before);
+    BOOST_CHECK(signer.VerifyMessage(key.GetPubKey(), vchSig, strMessage, strError));
+    BOOST_CHECK(signer.VerifyMessage(key.GetPubKey(), vchSig, strMessage, strError));
+    signer.GetCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nInserts, before.nInserts + 1);
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits + 1);
+
+    // A cached signature must not vouch for another key or message
+    BOOST_CHECK(!signer.VerifyMessage(keyOther.GetPubKey(), vchSig, strMessage, strError));
+    BOOST_CHECK(!signer.VerifyMessage(CPubKey(), vchSig, strMessage, strError));
+    BOOST_CHECK(!signer.VerifyMessage(key.GetPubKey(), vchSig, "throne pong", strError));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #define BOOST_TEST_MODULE Terracoin Test Suite
 
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "random.h"
@@ -31,12 +32,14 @@ struct TestingSetup {
     boost::thread_group threadGroup;
 
     TestingSetup() {
+        SHA256AutoDetect();
         ECC_Start();
         SetupEnvironment();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::MAIN);
         noui_connect();
+        InitSignatureCache();
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
 #endif
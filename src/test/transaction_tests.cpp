@@ -377,4 +377,39 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(test_PreCheckTransaction)
+{
+    // Runs on the pre-check workers, so must not need cs_main
+    CMutableTransaction t;
+    t.vin.resize(1);
+    t.vin[0].prevout.hash = GetRandHash();
+    t.vin[0].prevout.n = 0;
+    t.vin[0].scriptSig << std::vector<unsigned char>(65, 0);
+    t.vout.resize(1);
+    t.vout[0].nValue = 90*CENT;
+    CKey key;
+    key.MakeNewKey(true);
+    t.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CValidationState state;
+    BOOST_CHECK(PreCheckTransaction(t, state));
+    BOOST_CHECK(state.IsValid());
+
+    // Non-standard: rejected without a DoS score
+    t.vout[0].scriptPubKey = CScript() << OP_1;
+    int nDoS = -1;
+    state = CValidationState();
+    BOOST_CHECK(!PreCheckTransaction(t, state));
+    BOOST_CHECK(state.IsInvalid(nDoS) && nDoS == 0);
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "scriptpubkey");
+
+    // Loose coinbase: punished
+    t.vin[0].prevout.SetNull();
+    t.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    state = CValidationState();
+    BOOST_CHECK(!PreCheckTransaction(t, state));
+    BOOST_CHECK(state.IsInvalid(nDoS) && nDoS == 100);
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "coinbase");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
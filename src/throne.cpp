@@ -627,7 +627,7 @@ bool CThroneBroadcast::CheckInputsAndAdd(int& nDoS)
     mnodeman.Add(mn);
 
     // if it matches our Throne privkey, then we've been remotely activated
-    if(pubkey2 == activeThrone.pubKeyThrone && protocolVersion == PROTOCOL_VERSION){
+    if(pubkey2 == activeThrone.pubKeyThrone && protocolVersion >= MIN_THRONE_PAYMENT_PROTO_VERSION_2){
         activeThrone.EnableHotColdThroNe(vin, addr);
     }
 
@@ -12,25 +12,28 @@
 #include "utilmoneystr.h"
 #include "version.h"
 
-#include <boost/circular_buffer.hpp>
+#include <limits>
 
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0)
+    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
+    nSigOpCount(0), nFeeDelta(0), dPriorityDelta(0.0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
-                                 unsigned int _nHeight):
-    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+                                 unsigned int _nHeight, unsigned int _nP2SHSigOps):
+    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
+    nFeeDelta(0), dPriorityDelta(0.0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = tx.DynamicMemoryUsage();
+    nSigOpCount = GetLegacySigOpCount(tx) + _nP2SHSigOps;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -47,145 +50,226 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateDeltas(double _dPriorityDelta, const CAmount& _nFeeDelta)
+{
+    dPriorityDelta = _dPriorityDelta;
+    nFeeDelta = _nFeeDelta;
+}
+
 /**
- * Keep track of fee/priority for transactions confirmed within N blocks
+ * Exponentially decaying confirmation statistics for one quantity (fee rate
+ * or priority). Values are grouped into logarithmically spaced buckets, so
+ * recording a confirmed transaction is a single bucket update and the cost of
+ * answering a query does not depend on how much history has been seen.
  */
-class CBlockAverage
+class CConfirmStats
 {
 private:
-    boost::circular_buffer<CFeeRate> feeSamples;
-    boost::circular_buffer<double> prioritySamples;
-
-    template<typename T> std::vector<T> buf2vec(boost::circular_buffer<T> buf) const
+    //! Upper bound of every bucket, the last bucket catches everything above
+    std::vector<double> buckets;
+    //! confirmed[i][b]: decayed count of transactions in bucket b that confirmed in exactly i+1 blocks
+    std::vector<std::vector<double> > confirmed;
+    //! Decayed count of transactions in each bucket, however long they took
+    std::vector<double> txCount;
+    //! Decayed sum of the values recorded in each bucket
+    std::vector<double> valueSum;
+    //! Answer for each confirmation target, refreshed once per block
+    std::vector<double> estimates;
+
+    double decay;
+
+    size_t FindBucket(double dValue) const
     {
-        std::vector<T> vec(buf.begin(), buf.end());
-        return vec;
+        std::vector<double>::const_iterator it = std::lower_bound(buckets.begin(), buckets.end(), dValue);
+        if (it == buckets.end())
+            return buckets.size() - 1;
+        return it - buckets.begin();
     }
 
-public:
-    CBlockAverage() : feeSamples(100), prioritySamples(100) { }
+    /**
+     * Walk from the highest bucket down, grouping buckets until they hold enough
+     * data, and stop at the first group where too few transactions confirmed in
+     * time. The average value of the last group that passed is the estimate.
+     */
+    double EstimateFromCumulative(const std::vector<double>& within) const
+    {
+        double dConfirmed = 0, dTotal = 0;
+        int nFar = buckets.size() - 1, nBestNear = -1, nBestFar = -1;
+        for (int b = buckets.size() - 1; b >= 0; b--)
+        {
+            dConfirmed += within[b];
+            dTotal += txCount[b];
+            if (dTotal >= SUFFICIENT_TXS)
+            {
+                if (dConfirmed / dTotal < MIN_SUCCESS_PCT)
+                    break;
+                nBestNear = b;
+                nBestFar = nFar;
+                nFar = b - 1;
+                dConfirmed = dTotal = 0;
+            }
+        }
+        if (nBestNear < 0)
+            return -1;
 
-    void RecordFee(const CFeeRate& feeRate) {
-        feeSamples.push_back(feeRate);
+        double dSum = 0, dCount = 0;
+        for (int b = nBestNear; b <= nBestFar; b++)
+        {
+            dSum += valueSum[b];
+            dCount += txCount[b];
+        }
+        return dCount > 0 ? dSum / dCount : -1;
     }
 
-    void RecordPriority(double priority) {
-        prioritySamples.push_back(priority);
-    }
+public:
+    //! Fraction of transactions in a bucket group that must have confirmed within the target
+    static const double MIN_SUCCESS_PCT;
+    //! Decayed number of transactions a bucket group needs before it is trusted
+    static const double SUFFICIENT_TXS;
 
-    size_t FeeSamples() const { return feeSamples.size(); }
-    size_t GetFeeSamples(std::vector<CFeeRate>& insertInto) const
+    CConfirmStats(double dMin, double dMax, double dSpacing, int nMaxConfirms, double dDecay) : decay(dDecay)
     {
-        BOOST_FOREACH(const CFeeRate& f, feeSamples)
-            insertInto.push_back(f);
-        return feeSamples.size();
+        for (double dBoundary = dMin; dBoundary <= dMax; dBoundary *= dSpacing)
+            buckets.push_back(dBoundary);
+        buckets.push_back(std::numeric_limits<double>::max());
+        confirmed.assign(nMaxConfirms, std::vector<double>(buckets.size(), 0.0));
+        txCount.assign(buckets.size(), 0.0);
+        valueSum.assign(buckets.size(), 0.0);
+        estimates.assign(nMaxConfirms, -1.0);
     }
-    size_t PrioritySamples() const { return prioritySamples.size(); }
-    size_t GetPrioritySamples(std::vector<double>& insertInto) const
+
+    /** nBlocksToConfirm is 1 based. Transactions slower than the largest target only count towards the totals. */
+    void Record(int nBlocksToConfirm, double dValue)
     {
-        BOOST_FOREACH(double d, prioritySamples)
-            insertInto.push_back(d);
-        return prioritySamples.size();
+        size_t b = FindBucket(dValue);
+        if (nBlocksToConfirm >= 1 && nBlocksToConfirm <= (int)confirmed.size())
+            confirmed[nBlocksToConfirm - 1][b] += 1;
+        txCount[b] += 1;
+        valueSum[b] += dValue;
     }
 
-    /**
-     * Used as belt-and-suspenders check when reading to detect
-     * file corruption
-     */
-    static bool AreSane(const CFeeRate fee, const CFeeRate& minRelayFee)
+    /** Age all data by one block */
+    void Decay()
     {
-        if (fee < CFeeRate(0))
-            return false;
-        if (fee.GetFeePerK() > minRelayFee.GetFeePerK() * 10000)
-            return false;
-        return true;
+        for (size_t b = 0; b < buckets.size(); b++)
+        {
+            for (size_t i = 0; i < confirmed.size(); i++)
+                confirmed[i][b] *= decay;
+            txCount[b] *= decay;
+            valueSum[b] *= decay;
+        }
     }
-    static bool AreSane(const std::vector<CFeeRate>& vecFee, const CFeeRate& minRelayFee)
+
+    /** Recompute the cached answer for every target; called once per block */
+    void UpdateEstimates()
     {
-        BOOST_FOREACH(CFeeRate fee, vecFee)
+        std::vector<double> within(buckets.size(), 0.0);
+        for (size_t i = 0; i < confirmed.size(); i++)
         {
-            if (!AreSane(fee, minRelayFee))
-                return false;
+            for (size_t b = 0; b < buckets.size(); b++)
+                within[b] += confirmed[i][b];
+            estimates[i] = EstimateFromCumulative(within);
         }
-        return true;
     }
-    static bool AreSane(const double priority)
+
+    /** Returns -1 if there is not enough data. nBlocksToConfirm is 1 based. */
+    double Estimate(int nBlocksToConfirm) const
     {
-        return priority >= 0;
+        if (nBlocksToConfirm < 1 || nBlocksToConfirm > (int)estimates.size())
+            return -1;
+        return estimates[nBlocksToConfirm - 1];
     }
-    static bool AreSane(const std::vector<double> vecPriority)
+
+    double TotalTxs() const
     {
-        BOOST_FOREACH(double priority, vecPriority)
-        {
-            if (!AreSane(priority))
-                return false;
-        }
-        return true;
+        double dTotal = 0;
+        BOOST_FOREACH(double d, txCount)
+            dTotal += d;
+        return dTotal;
     }
 
     void Write(CAutoFile& fileout) const
     {
-        std::vector<CFeeRate> vecFee = buf2vec(feeSamples);
-        fileout << vecFee;
-        std::vector<double> vecPriority = buf2vec(prioritySamples);
-        fileout << vecPriority;
+        fileout << decay;
+        fileout << buckets;
+        fileout << txCount;
+        fileout << valueSum;
+        fileout << confirmed;
     }
 
-    void Read(CAutoFile& filein, const CFeeRate& minRelayFee) {
-        std::vector<CFeeRate> vecFee;
-        filein >> vecFee;
-        if (AreSane(vecFee, minRelayFee))
-            feeSamples.insert(feeSamples.end(), vecFee.begin(), vecFee.end());
-        else
-            throw runtime_error("Corrupt fee value in estimates file.");
-        std::vector<double> vecPriority;
-        filein >> vecPriority;
-        if (AreSane(vecPriority))
-            prioritySamples.insert(prioritySamples.end(), vecPriority.begin(), vecPriority.end());
-        else
-            throw runtime_error("Corrupt priority value in estimates file.");
-        if (feeSamples.size() + prioritySamples.size() > 0)
-            LogPrint("estimatefee", "Read %d fee samples and %d priority samples\n",
-                     feeSamples.size(), prioritySamples.size());
+    /**
+     * Only accepts data that was written with the same bucket layout and
+     * target count; anything else is treated as corruption.
+     */
+    void Read(CAutoFile& filein)
+    {
+        double fileDecay;
+        std::vector<double> fileBuckets, fileTxCount, fileValueSum;
+        std::vector<std::vector<double> > fileConfirmed;
+        filein >> fileDecay >> fileBuckets >> fileTxCount >> fileValueSum >> fileConfirmed;
+
+        if (fileDecay <= 0 || fileDecay >= 1)
+            throw runtime_error("Corrupt estimates file. Decay must be between 0 and 1.");
+        if (fileBuckets != buckets)
+            throw runtime_error("Corrupt estimates file. Bucket layout does not match.");
+        if (fileTxCount.size() != buckets.size() || fileValueSum.size() != buckets.size() ||
+            fileConfirmed.size() != confirmed.size())
+            throw runtime_error("Corrupt estimates file. Mismatch in bucket count.");
+        for (size_t b = 0; b < buckets.size(); b++)
+        {
+            if (!(fileTxCount[b] >= 0) || !(fileValueSum[b] >= 0))
+                throw runtime_error("Corrupt estimates file. Negative bucket total.");
+        }
+        BOOST_FOREACH(const std::vector<double>& row, fileConfirmed)
+        {
+            if (row.size() != buckets.size())
+                throw runtime_error("Corrupt estimates file. Mismatch in bucket count.");
+            BOOST_FOREACH(double d, row)
+                if (!(d >= 0))
+                    throw runtime_error("Corrupt estimates file. Negative confirmation count.");
+        }
+
+        decay = fileDecay;
+        txCount = fileTxCount;
+        valueSum = fileValueSum;
+        confirmed = fileConfirmed;
+        UpdateEstimates();
     }
 };
 
+const double CConfirmStats::MIN_SUCCESS_PCT = 0.85;
+const double CConfirmStats::SUFFICIENT_TXS = 11;
+
 class CMinerPolicyEstimator
 {
 private:
-    /**
-     * Records observed averages transactions that confirmed within one block, two blocks,
-     * three blocks etc.
-     */
-    std::vector<CBlockAverage> history;
-    std::vector<CFeeRate> sortedFeeSamples;
-    std::vector<double> sortedPrioritySamples;
+    //! Per-block decay; old data loses half its weight after roughly 350 blocks
+    static const double DEFAULT_DECAY;
+
+    CConfirmStats feeStats;
+    CConfirmStats priorityStats;
 
     int nBestSeenHeight;
 
     /**
-     * nBlocksAgo is 0 based, i.e. transactions that confirmed in the highest seen block are
-     * nBlocksAgo == 0, transactions in the block before that are nBlocksAgo == 1 etc.
+     * nBlocksToConfirm is 1 based, i.e. transactions that confirmed in the block right
+     * after they entered the mempool took one block.
      */
-    void seenTxConfirm(const CFeeRate& feeRate, const CFeeRate& minRelayFee, double dPriority, int nBlocksAgo)
+    void seenTxConfirm(const CFeeRate& feeRate, const CFeeRate& minRelayFee, double dPriority, int nBlocksToConfirm)
     {
-        // Last entry records "everything else".
-        int nBlocksTruncated = min(nBlocksAgo, (int) history.size() - 1);
-        assert(nBlocksTruncated >= 0);
-
         // We need to guess why the transaction was included in a block-- either
         // because it is high-priority or because it has sufficient fees.
         bool sufficientFee = (feeRate > minRelayFee);
         bool sufficientPriority = AllowFree(dPriority);
         const char* assignedTo = "unassigned";
-        if (sufficientFee && !sufficientPriority && CBlockAverage::AreSane(feeRate, minRelayFee))
+        if (sufficientFee && !sufficientPriority && AreSane(feeRate, minRelayFee))
         {
-            history[nBlocksTruncated].RecordFee(feeRate);
+            feeStats.Record(nBlocksToConfirm, (double)feeRate.GetFeePerK());
             assignedTo = "fee";
         }
-        else if (sufficientPriority && !sufficientFee && CBlockAverage::AreSane(dPriority))
+        else if (sufficientPriority && !sufficientFee && AreSane(dPriority))
         {
-            history[nBlocksTruncated].RecordPriority(dPriority);
+            priorityStats.Record(nBlocksToConfirm, dPriority);
             assignedTo = "priority";
         }
         else
@@ -194,13 +278,34 @@ private:
             // don't know why they got confirmed.
         }
         LogPrint("estimatefee", "Seen TX confirm: %s : %s fee/%g priority, took %d blocks\n",
-                 assignedTo, feeRate.ToString(), dPriority, nBlocksAgo);
+                 assignedTo, feeRate.ToString(), dPriority, nBlocksToConfirm);
     }
 
 public:
-    CMinerPolicyEstimator(int nEntries) : nBestSeenHeight(0)
+    CMinerPolicyEstimator(int nEntries) :
+        // Fee rates from 10 satoshi/kB up to 1 coin/kB in 10% steps
+        feeStats(10, 1e8, 1.1, nEntries, DEFAULT_DECAY),
+        // Priorities from 10 up to 1e16, doubling each step
+        priorityStats(10, 1e16, 2, nEntries, DEFAULT_DECAY),
+        nBestSeenHeight(0)
+    {
+    }
+
+    /**
+     * Used as belt-and-suspenders check to keep absurd values out of the
+     * buckets
+     */
+    static bool AreSane(const CFeeRate fee, const CFeeRate& minRelayFee)
+    {
+        if (fee < CFeeRate(0))
+            return false;
+        if (fee.GetFeePerK() > minRelayFee.GetFeePerK() * 10000)
+            return false;
+        return true;
+    }
+    static bool AreSane(const double priority)
     {
-        history.resize(nEntries);
+        return priority >= 0;
     }
 
     void seenBlock(const std::vector<CTxMemPoolEntry>& entries, int nBlockHeight, const CFeeRate minRelayFee)
@@ -216,10 +321,10 @@ public:
         }
         nBestSeenHeight = nBlockHeight;
 
-        // Fill up the history buckets based on how long transactions took
-        // to confirm.
-        std::vector<std::vector<const CTxMemPoolEntry*> > entriesByConfirmations;
-        entriesByConfirmations.resize(history.size());
+        feeStats.Decay();
+        priorityStats.Decay();
+
+        std::map<int, std::vector<const CTxMemPoolEntry*> > entriesByConfirmations;
         BOOST_FOREACH(const CTxMemPoolEntry& entry, entries)
         {
             // How many blocks did it take for miners to include this transaction?
@@ -230,15 +335,14 @@ public:
                 // to re-org on a difficulty transition point: very rare!
                 continue;
             }
-            if ((delta-1) >= (int)history.size())
-                delta = history.size(); // Last bucket is catch-all
-            entriesByConfirmations.at(delta-1).push_back(&entry);
+            entriesByConfirmations[delta].push_back(&entry);
         }
-        for (size_t i = 0; i < entriesByConfirmations.size(); i++)
+        for (std::map<int, std::vector<const CTxMemPoolEntry*> >::iterator it = entriesByConfirmations.begin();
+             it != entriesByConfirmations.end(); ++it)
         {
-            std::vector<const CTxMemPoolEntry*> &e = entriesByConfirmations.at(i);
-            // Insert at most 10 random entries per bucket, otherwise a single block
-            // can dominate an estimate:
+            std::vector<const CTxMemPoolEntry*>& e = it->second;
+            // Insert at most 10 random entries per confirmation count, otherwise a
+            // single block can dominate an estimate:
             if (e.size() > 10) {
                 std::random_shuffle(e.begin(), e.end());
                 e.resize(10);
@@ -248,129 +352,62 @@ public:
                 // Fees are stored and reported as BTC-per-kb:
                 CFeeRate feeRate(entry->GetFee(), entry->GetTxSize());
                 double dPriority = entry->GetPriority(entry->GetHeight()); // Want priority when it went IN
-                seenTxConfirm(feeRate, minRelayFee, dPriority, i);
+                seenTxConfirm(feeRate, minRelayFee, dPriority, it->first);
             }
         }
 
-        //After new samples are added, we have to clear the sorted lists,
-        //so they'll be resorted the next time someone asks for an estimate
-        sortedFeeSamples.clear();
-        sortedPrioritySamples.clear();
-
-        for (size_t i = 0; i < history.size(); i++) {
-            if (history[i].FeeSamples() + history[i].PrioritySamples() > 0)
-                LogPrint("estimatefee", "estimates: for confirming within %d blocks based on %d/%d samples, fee=%s, prio=%g\n", 
-                         i,
-                         history[i].FeeSamples(), history[i].PrioritySamples(),
-                         estimateFee(i+1).ToString(), estimatePriority(i+1));
-        }
+        feeStats.UpdateEstimates();
+        priorityStats.UpdateEstimates();
+
+        LogPrint("estimatefee", "estimates: based on %g/%g samples, fee=%s in 1 block, prio=%g in 1 block\n",
+                 feeStats.TotalTxs(), priorityStats.TotalTxs(),
+                 estimateFee(1).ToString(), estimatePriority(1));
     }
 
     /**
      * Can return CFeeRate(0) if we don't have any data for that many blocks back. nBlocksToConfirm is 1 based.
      */
-    CFeeRate estimateFee(int nBlocksToConfirm)
+    CFeeRate estimateFee(int nBlocksToConfirm) const
     {
-        nBlocksToConfirm--;
-
-        if (nBlocksToConfirm < 0 || nBlocksToConfirm >= (int)history.size())
+        double dFeePerK = feeStats.Estimate(nBlocksToConfirm);
+        if (dFeePerK < 0)
             return CFeeRate(0);
-
-        if (sortedFeeSamples.size() == 0)
-        {
-            for (size_t i = 0; i < history.size(); i++)
-                history.at(i).GetFeeSamples(sortedFeeSamples);
-            std::sort(sortedFeeSamples.begin(), sortedFeeSamples.end(),
-                      std::greater<CFeeRate>());
-        }
-        if (sortedFeeSamples.size() < 11)
-        {
-            // Eleven is Gavin's Favorite Number
-            // ... but we also take a maximum of 10 samples per block so eleven means
-            // we're getting samples from at least two different blocks
-            return CFeeRate(0);
-        }
-
-        int nBucketSize = history.at(nBlocksToConfirm).FeeSamples();
-
-        // Estimates should not increase as number of confirmations goes up,
-        // but the estimates are noisy because confirmations happen discretely
-        // in blocks. To smooth out the estimates, use all samples in the history
-        // and use the nth highest where n is (number of samples in previous bucket +
-        // half the samples in nBlocksToConfirm bucket):
-        size_t nPrevSize = 0;
-        for (int i = 0; i < nBlocksToConfirm; i++)
-            nPrevSize += history.at(i).FeeSamples();
-        size_t index = min(nPrevSize + nBucketSize/2, sortedFeeSamples.size()-1);
-        return sortedFeeSamples[index];
+        return CFeeRate((CAmount)dFeePerK);
     }
-    double estimatePriority(int nBlocksToConfirm)
-    {
-        nBlocksToConfirm--;
 
-        if (nBlocksToConfirm < 0 || nBlocksToConfirm >= (int)history.size())
-            return -1;
-
-        if (sortedPrioritySamples.size() == 0)
-        {
-            for (size_t i = 0; i < history.size(); i++)
-                history.at(i).GetPrioritySamples(sortedPrioritySamples);
-            std::sort(sortedPrioritySamples.begin(), sortedPrioritySamples.end(),
-                      std::greater<double>());
-        }
-        if (sortedPrioritySamples.size() < 11)
-            return -1.0;
-
-        int nBucketSize = history.at(nBlocksToConfirm).PrioritySamples();
-
-        // Estimates should not increase as number of confirmations needed goes up,
-        // but the estimates are noisy because confirmations happen discretely
-        // in blocks. To smooth out the estimates, use all samples in the history
-        // and use the nth highest where n is (number of samples in previous buckets +
-        // half the samples in nBlocksToConfirm bucket).
-        size_t nPrevSize = 0;
-        for (int i = 0; i < nBlocksToConfirm; i++)
-            nPrevSize += history.at(i).PrioritySamples();
-        size_t index = min(nPrevSize + nBucketSize/2, sortedPrioritySamples.size()-1);
-        return sortedPrioritySamples[index];
+    double estimatePriority(int nBlocksToConfirm) const
+    {
+        return priorityStats.Estimate(nBlocksToConfirm);
     }
 
     void Write(CAutoFile& fileout) const
     {
         fileout << nBestSeenHeight;
-        fileout << history.size();
-        BOOST_FOREACH(const CBlockAverage& entry, history)
-        {
-            entry.Write(fileout);
-        }
+        feeStats.Write(fileout);
+        priorityStats.Write(fileout);
     }
 
-    void Read(CAutoFile& filein, const CFeeRate& minRelayFee)
+    void Read(CAutoFile& filein)
     {
         int nFileBestSeenHeight;
         filein >> nFileBestSeenHeight;
-        size_t numEntries;
-        filein >> numEntries;
-        if (numEntries <= 0 || numEntries > 10000)
-            throw runtime_error("Corrupt estimates file. Must have between 1 and 10k entries.");
-
-        std::vector<CBlockAverage> fileHistory;
-        
-        for (size_t i = 0; i < numEntries; i++)
-        {
-            CBlockAverage entry;
-            entry.Read(filein, minRelayFee);
-            fileHistory.push_back(entry);
-        }
 
-        // Now that we've processed the entire fee estimate data file and not
-        // thrown any errors, we can copy it to our history
+        // Read into copies so that a corrupt file leaves the current
+        // statistics untouched
+        CConfirmStats fileFeeStats(feeStats), filePriorityStats(priorityStats);
+        fileFeeStats.Read(filein);
+        filePriorityStats.Read(filein);
+
         nBestSeenHeight = nFileBestSeenHeight;
-        history = fileHistory;
-        assert(history.size() > 0);
+        feeStats = fileFeeStats;
+        priorityStats = filePriorityStats;
+        LogPrint("estimatefee", "Read %g fee samples and %g priority samples\n",
+                 feeStats.TotalTxs(), priorityStats.TotalTxs());
     }
 };
 
+const double CMinerPolicyEstimator::DEFAULT_DECAY = 0.998;
+
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
     nTransactionsUpdated(0),
@@ -428,6 +465,9 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
     LOCK(cs);
     {
         mapTx[hash] = entry;
+        std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+        if (pos != mapDeltas.end())
+            mapTx[hash].UpdateDeltas(pos->second.first, pos->second.second);
         const CTransaction& tx = mapTx[hash].GetTx();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
@@ -668,12 +708,15 @@ double CTxMemPool::estimatePriority(int nBlocks) const
     return minerPolicyEstimator->estimatePriority(nBlocks);
 }
 
+/** Oldest client version able to read the current fee estimates file format */
+static const int FEE_ESTIMATES_VERSION = 120100;
+
 bool
 CTxMemPool::WriteFeeEstimates(CAutoFile& fileout) const
 {
     try {
         LOCK(cs);
-        fileout << 120000; // version required to read: 0.12.00 or later
+        fileout << FEE_ESTIMATES_VERSION; // version required to read: decaying bucket format
         fileout << CLIENT_VERSION; // version that wrote the file
         minerPolicyEstimator->Write(fileout);
     }
@@ -692,9 +735,11 @@ CTxMemPool::ReadFeeEstimates(CAutoFile& filein)
         filein >> nVersionRequired >> nVersionThatWrote;
         if (nVersionRequired > CLIENT_VERSION)
             return error("CTxMemPool::ReadFeeEstimates() : up-version (%d) fee estimate file", nVersionRequired);
+        if (nVersionRequired < FEE_ESTIMATES_VERSION)
+            return error("CTxMemPool::ReadFeeEstimates() : ignoring old-format (%d) fee estimate file", nVersionRequired);
 
         LOCK(cs);
-        minerPolicyEstimator->Read(filein, minRelayFee);
+        minerPolicyEstimator->Read(filein);
     }
     catch (const std::exception &) {
         LogPrintf("CTxMemPool::ReadFeeEstimates() : unable to read policy estimator data (non-fatal)");
@@ -710,6 +755,9 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+        if (it != mapTx.end())
+            it->second.UpdateDeltas(deltas.first, deltas.second);
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -45,10 +45,15 @@ private:
     int64_t nTime; //! Local time when entering the mempool
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    unsigned int nSigOpCount; //! Legacy plus P2SH sigops, so block assembly needs no input lookups
+    CAmount nFeeDelta; //! Fee delta from PrioritiseTransaction
+    double dPriorityDelta; //! Priority delta from PrioritiseTransaction
 
 public:
+    /** Legacy sigops are counted here, P2SH sigops need the inputs and are passed in by the caller */
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
-                    int64_t _nTime, double _dPriority, unsigned int _nHeight);
+                    int64_t _nTime, double _dPriority, unsigned int _nHeight,
+                    unsigned int _nP2SHSigOps);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
@@ -59,6 +64,12 @@ public:
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
+    unsigned int GetSigOpCount() const { return nSigOpCount; }
+    CAmount GetFeeDelta() const { return nFeeDelta; }
+    double GetPriorityDelta() const { return dPriorityDelta; }
+    //! Fee including the PrioritiseTransaction delta, as used for block assembly
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+    void UpdateDeltas(double _dPriorityDelta, const CAmount& _nFeeDelta);
 };
 
 class CMinerPolicyEstimator;
@@ -9,7 +9,7 @@
 /**
  * network protocol versioning
  */
-static const int PROTOCOL_VERSION = 70002;
+static const int PROTOCOL_VERSION = 70003;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -21,19 +21,19 @@ static const int GETHEADERS_VERSION = 31800;
 static const int MIN_PEER_PROTO_VERSION = GETHEADERS_VERSION;
 
 //! minimum peer version accepted by DarksendPool
-static const int MIN_POOL_PEER_PROTO_VERSION = PROTOCOL_VERSION;
+static const int MIN_POOL_PEER_PROTO_VERSION = 70002;
 
 //! minimum peer version for throne budgets
-static const int MIN_BUDGET_PEER_PROTO_VERSION = PROTOCOL_VERSION;
+static const int MIN_BUDGET_PEER_PROTO_VERSION = 70002;
 
 //! minimum peer version for throne winner broadcasts
-static const int MIN_MNW_PEER_PROTO_VERSION = PROTOCOL_VERSION;
+static const int MIN_MNW_PEER_PROTO_VERSION = 70002;
 
 //! minimum peer version that can receive throne payments
 // V1 - Last protocol version before update
 // V2 - Newest protocol version
-static const int MIN_THRONE_PAYMENT_PROTO_VERSION_1 = PROTOCOL_VERSION;
-static const int MIN_THRONE_PAYMENT_PROTO_VERSION_2 = PROTOCOL_VERSION;
+static const int MIN_THRONE_PAYMENT_PROTO_VERSION_1 = 70002;
+static const int MIN_THRONE_PAYMENT_PROTO_VERSION_2 = 70002;
 
 //! nTime field added to CAddress, starting with this version;
 //! if possible, avoid requesting addresses nodes older than this
@@ -49,4 +49,7 @@ static const int BIP0031_VERSION = 60000;
 //! "mempool" command, enhanced "getdata" behavior starts with this version
 static const int MEMPOOL_GD_VERSION = 60002;
 
+//! "batch" envelopes of throne, budget, instantx and spork messages start with this version
+static const int BATCH_VERSION = 70003;
+
 #endif // BITCOIN_VERSION_H